@@ -0,0 +1,184 @@
+/**
+  * @file    SaraN2Compression.cpp
+  * @version 0.5.0
+  * @author  Adam Mitchell
+  * @brief   C++ file of the static dictionary payload codec
+  */
+
+/** Includes
+ */
+#include "SaraN2Compression.h"
+
+#include <string.h>
+
+/** Compress a payload against a dictionary
+ *
+ * @param &dictionary Dictionary to compress against, at most
+ *                    SARAN2_DICTIONARY_MAX_ENTRIES entries are used
+ * @param *input Pointer to the payload to compress
+ * @param input_length Number of bytes in the payload
+ * @param *output Pointer to a byte array in which to store the result.
+ *                1 + 2 * input_length bytes is always sufficient
+ * @param output_size Size of output in bytes
+ * @return Number of bytes written or OUTPUT_TOO_SMALL
+ */
+int SaraN2Compression::compress(const Dictionary_t &dictionary, const uint8_t *input, size_t input_length,
+                                uint8_t *output, size_t output_size)
+{
+	if(output_size < 1)
+	{
+		return SaraN2Compression::OUTPUT_TOO_SMALL;
+	}
+
+	uint8_t entries = (dictionary.count > SARAN2_DICTIONARY_MAX_ENTRIES) ? SARAN2_DICTIONARY_MAX_ENTRIES : dictionary.count;
+
+	size_t n = 0;
+	output[n++] = dictionary.id;
+
+	size_t i = 0;
+	while(i < input_length)
+	{
+		/* Greedy longest match. Comparing the first byte before calling memcmp
+		 * keeps the scan cheap for the small dictionaries used on the MCU
+		 */
+		int best = -1;
+		uint8_t best_length = 1;
+
+		for(uint8_t e = 0; e < entries; e++)
+		{
+			const Entry_t &entry = dictionary.entries[e];
+
+			if(entry.length > best_length && entry.length <= input_length - i &&
+			   entry.data[0] == input[i] && memcmp(entry.data, &input[i], entry.length) == 0)
+			{
+				best = e;
+				best_length = entry.length;
+			}
+		}
+
+		if(best >= 0)
+		{
+			if(n + 1 > output_size)
+			{
+				return SaraN2Compression::OUTPUT_TOO_SMALL;
+			}
+
+			output[n++] = SARAN2_DICTIONARY_FIRST_TOKEN + best;
+			i += best_length;
+		}
+		else if(input[i] < SARAN2_DICTIONARY_FIRST_TOKEN)
+		{
+			if(n + 1 > output_size)
+			{
+				return SaraN2Compression::OUTPUT_TOO_SMALL;
+			}
+
+			output[n++] = input[i++];
+		}
+		else
+		{
+			if(n + 2 > output_size)
+			{
+				return SaraN2Compression::OUTPUT_TOO_SMALL;
+			}
+
+			output[n++] = SARAN2_DICTIONARY_ESCAPE;
+			output[n++] = input[i++];
+		}
+	}
+
+	return n;
+}
+
+/** Decompress a payload produced by compress()
+ *
+ * @param &dictionary Dictionary the payload was compressed against,
+ *                    which can be found with dictionary_id()
+ * @param *input Pointer to the compressed payload
+ * @param input_length Number of bytes in the compressed payload
+ * @param *output Pointer to a byte array in which to store the result
+ * @param output_size Size of output in bytes
+ * @return Number of bytes written, OUTPUT_TOO_SMALL, INVALID_INPUT or
+ *         DICTIONARY_MISMATCH
+ */
+int SaraN2Compression::decompress(const Dictionary_t &dictionary, const uint8_t *input, size_t input_length,
+                                  uint8_t *output, size_t output_size)
+{
+	if(input_length < 1)
+	{
+		return SaraN2Compression::INVALID_INPUT;
+	}
+
+	if(input[0] != dictionary.id)
+	{
+		return SaraN2Compression::DICTIONARY_MISMATCH;
+	}
+
+	size_t n = 0;
+
+	for(size_t i = 1; i < input_length; i++)
+	{
+		uint8_t token = input[i];
+
+		if(token == SARAN2_DICTIONARY_ESCAPE)
+		{
+			if(++i >= input_length)
+			{
+				return SaraN2Compression::INVALID_INPUT;
+			}
+
+			if(n + 1 > output_size)
+			{
+				return SaraN2Compression::OUTPUT_TOO_SMALL;
+			}
+
+			output[n++] = input[i];
+		}
+		else if(token >= SARAN2_DICTIONARY_FIRST_TOKEN)
+		{
+			uint8_t index = token - SARAN2_DICTIONARY_FIRST_TOKEN;
+
+			if(index >= dictionary.count)
+			{
+				return SaraN2Compression::INVALID_INPUT;
+			}
+
+			const Entry_t &entry = dictionary.entries[index];
+
+			if(n + entry.length > output_size)
+			{
+				return SaraN2Compression::OUTPUT_TOO_SMALL;
+			}
+
+			memcpy(&output[n], entry.data, entry.length);
+			n += entry.length;
+		}
+		else
+		{
+			if(n + 1 > output_size)
+			{
+				return SaraN2Compression::OUTPUT_TOO_SMALL;
+			}
+
+			output[n++] = token;
+		}
+	}
+
+	return n;
+}
+
+/** Read the id of the dictionary a payload was compressed against
+ *
+ * @param *input Pointer to the compressed payload
+ * @param input_length Number of bytes in the compressed payload
+ * @return Dictionary id or INVALID_INPUT
+ */
+int SaraN2Compression::dictionary_id(const uint8_t *input, size_t input_length)
+{
+	if(input_length < 1)
+	{
+		return SaraN2Compression::INVALID_INPUT;
+	}
+
+	return input[0];
+}
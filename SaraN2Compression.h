@@ -0,0 +1,103 @@
+/**
+  * @file    SaraN2Compression.h
+  * @version 0.5.0
+  * @author  Adam Mitchell
+  * @brief   Header file of the static dictionary payload codec. Has no Mbed
+  *          dependencies so that the same code can decode payloads server-side
+  */
+
+/** Define to prevent recursive inclusion
+ */
+#pragma once
+
+/** Includes
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+/** Codec-specific #defines
+ */
+#define SARAN2_DICTIONARY_MAX_ENTRIES 127
+#define SARAN2_DICTIONARY_ESCAPE      0xFF
+#define SARAN2_DICTIONARY_FIRST_TOKEN 0x80
+
+/** Compresses structured payloads, i.e. JSON or CBOR, against a shared and
+ *  versioned static dictionary of byte strings that recur in every message,
+ *  such as keys and units. A compressed payload is laid out as:
+ *
+ *  [dictionary id] followed by tokens, where a token is
+ *      0x00-0x7F           a literal byte
+ *      0x80-0xFE           dictionary entry (token - 0x80)
+ *      0xFF <byte>         an escaped literal byte in the range 0x80-0xFF
+ *
+ *  The dictionary id travels in the payload so that the server can select
+ *  the matching dictionary. Dictionaries are built offline from sample
+ *  traffic with tools/build_dictionary.py
+ */
+class SaraN2Compression
+{
+
+	public:
+
+		/** Function return codes
+		 */
+		enum
+		{
+			OUTPUT_TOO_SMALL     = -1,
+			INVALID_INPUT        = -2,
+			DICTIONARY_MISMATCH  = -3
+		};
+
+		/** Single dictionary entry
+		 */
+		struct Entry_t
+		{
+			const uint8_t *data;
+			uint8_t        length;
+		};
+
+		/** Static dictionary shared between device and server
+		 */
+		struct Dictionary_t
+		{
+			uint8_t        id;
+			uint8_t        count;
+			const Entry_t *entries;
+		};
+
+		/** Compress a payload against a dictionary
+		 *
+		 * @param &dictionary Dictionary to compress against, at most
+		 *                    SARAN2_DICTIONARY_MAX_ENTRIES entries are used
+		 * @param *input Pointer to the payload to compress
+		 * @param input_length Number of bytes in the payload
+		 * @param *output Pointer to a byte array in which to store the result.
+		 *                1 + 2 * input_length bytes is always sufficient
+		 * @param output_size Size of output in bytes
+		 * @return Number of bytes written or OUTPUT_TOO_SMALL
+		 */
+		static int compress(const Dictionary_t &dictionary, const uint8_t *input, size_t input_length,
+		                    uint8_t *output, size_t output_size);
+
+		/** Decompress a payload produced by compress()
+		 *
+		 * @param &dictionary Dictionary the payload was compressed against,
+		 *                    which can be found with dictionary_id()
+		 * @param *input Pointer to the compressed payload
+		 * @param input_length Number of bytes in the compressed payload
+		 * @param *output Pointer to a byte array in which to store the result
+		 * @param output_size Size of output in bytes
+		 * @return Number of bytes written, OUTPUT_TOO_SMALL, INVALID_INPUT or
+		 *         DICTIONARY_MISMATCH
+		 */
+		static int decompress(const Dictionary_t &dictionary, const uint8_t *input, size_t input_length,
+		                      uint8_t *output, size_t output_size);
+
+		/** Read the id of the dictionary a payload was compressed against
+		 *
+		 * @param *input Pointer to the compressed payload
+		 * @param input_length Number of bytes in the compressed payload
+		 * @return Dictionary id or INVALID_INPUT
+		 */
+		static int dictionary_id(const uint8_t *input, size_t input_length);
+};
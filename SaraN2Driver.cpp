@@ -10,9 +10,6 @@
  */
 #include "SaraN2Driver.h"
 
-#include <string>
-#include <sstream>  
-
 /** Constructor for the SaraN2 class. Instantiates an ATCmdParser object
  *  on the heap for comms between microcontroller and modem
  * 
@@ -29,9 +26,23 @@ SaraN2::SaraN2(PinName txu, PinName rxu, PinName cts, PinName rst, PinName vint,
 			   _cts(cts), _rst(rst, 1), _vint(vint), _gpio(gpio)
 {
 	_serial = new UARTSerial(txu, rxu, baud);
+#if SARAN2_FAULT_INJECTION
+	_fault = new SaraN2FaultInjector(_serial);
+	_parser = new ATCmdParser(_fault);
+#else
 	_parser = new ATCmdParser(_serial);
+#endif
 	_parser->set_delimiter("\r\n");
-	_parser->set_timeout(500);
+	_parser->set_timeout(_at_timeout_ms);
+
+#if SARAN2_FEATURE_TIME
+	_parser->oob("+CTZV:", callback(this, &SaraN2::_nitz_urc));
+	_parser->oob("+CTZEU:", callback(this, &SaraN2::_nitz_urc));
+#endif
+
+#if SARAN2_FEATURE_TIMELINE
+	_parser->oob("+CSCON:", callback(this, &SaraN2::_cscon_urc));
+#endif
 }
 
 /** Destructor for the SaraN2 class. Deletes the UARTSerial and ATCmdParser
@@ -39,10 +50,184 @@ SaraN2::SaraN2(PinName txu, PinName rxu, PinName cts, PinName rst, PinName vint,
  */  
 SaraN2::~SaraN2()
 {
+#if SARAN2_FEATURE_ASYNC_BOOT
+	if(_boot_thread != NULL)
+	{
+		_boot_thread->join();
+		delete _boot_thread;
+	}
+#endif
+
 	delete _serial;
 	delete _parser;
+#if SARAN2_FAULT_INJECTION
+	delete _fault;
+#endif
+}
+
+#if SARAN2_FEATURE_ASYNC_BOOT
+
+/** Start the module asynchronously. A start-up thread resets the
+ *  module with RESET_N, unless a warm state is given, waits for VINT
+ *  to go high, then probes the module with "AT" until it responds
+ *  (skipping over the "u-blox" power-on banner), and finally runs the
+ *  optional configuration callback. This function returns immediately
+ *  so that the rest of the system can initialise in parallel
+ *
+ * @param ready_cb Optional callback invoked from the start-up thread
+ *                 with the final start-up status
+ * @param configure Optional callback invoked once the module responds,
+ *                  i.e. to select and load a CoAP profile. A non-zero
+ *                  return value is reported as the start-up status
+ * @param *warm_state Optional state saved before an MCU-only reset,
+ *                    copied before this function returns. If 
+ *                    restore_warm_state() accepts it the module is
+ *                    already configured and configure is skipped
+ * @return Indicates success or failure reason
+ */
+int SaraN2::begin(Callback<void(int)> ready_cb, Callback<int()> configure, const WarmState_t *warm_state)
+{
+	if(_boot_status == SaraN2::BOOT_IN_PROGRESS)
+	{
+		return SaraN2::BOOT_IN_PROGRESS;
+	}
+
+	if(_boot_thread != NULL)
+	{
+		_boot_thread->join();
+		delete _boot_thread;
+	}
+
+	_ready_cb = ready_cb;
+	_configure_cb = configure;
+	_warm_state_given = warm_state != NULL;
+	if(_warm_state_given)
+	{
+		_warm_state = *warm_state;
+	}
+	_boot_status = SaraN2::BOOT_IN_PROGRESS;
+	_boot_flags.clear(SARAN2_BOOT_DONE_FLAG);
+
+	_boot_thread = new Thread(osPriorityNormal, SARAN2_BOOT_STACK_SIZE);
+	if(_boot_thread->start(callback(this, &SaraN2::_boot_task)) != osOK)
+	{
+		delete _boot_thread;
+		_boot_thread = NULL;
+		_boot_status = SaraN2::FAIL_BOOT;
+		return SaraN2::FAIL_BOOT;
+	}
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Block until asynchronous start-up, started with begin(), completes
+ *
+ * @param timeout_ms Maximum time to wait in milliseconds
+ * @return Start-up status, FAIL_BOOT_TIMEOUT if start-up did not 
+ *         complete in time or FAIL_BOOT if begin() was not called
+ */
+int SaraN2::wait_ready(uint32_t timeout_ms)
+{
+	if(_boot_thread == NULL)
+	{
+		return SaraN2::FAIL_BOOT;
+	}
+
+	uint32_t flags = _boot_flags.wait_all(SARAN2_BOOT_DONE_FLAG, timeout_ms, false);
+	if((flags & osFlagsError) || !(flags & SARAN2_BOOT_DONE_FLAG))
+	{
+		return SaraN2::FAIL_BOOT_TIMEOUT;
+	}
+
+	return _boot_status;
+}
+
+/** Non-blocking check of asynchronous start-up status
+ *
+ * @return SARAN2_OK if the module is ready, BOOT_IN_PROGRESS if 
+ *         start-up is still running, otherwise failure reason
+ */
+int SaraN2::is_ready()
+{
+	return _boot_status;
+}
+
+/** Body of the asynchronous start-up thread created by begin()
+ */
+void SaraN2::_boot_task()
+{
+	int status = SaraN2::FAIL_BOOT_TIMEOUT;
+
+	/* Reset the module into a known state by pulsing RESET_N low, unless
+	 * a warm state says it kept running through an MCU-only reset
+	 */
+	if(!_warm_state_given)
+	{
+		_rst = 0;
+		ThisThread::sleep_for(SARAN2_RESET_PULSE_MS);
+		_rst = 1;
+	}
+
+	uint64_t start = Kernel::get_ms_count();
+
+	while(Kernel::get_ms_count() - start < SARAN2_BOOT_TIMEOUT_MS)
+	{
+		/* VINT stays low until the module's supply rails are up, so there
+		 * is no point talking to it before then
+		 */
+		if(_vint.read() == 0)
+		{
+			ThisThread::sleep_for(10);
+			continue;
+		}
+
+		/* Hold the lock for one probe at a time, so that other threads
+		 * are not blocked for the whole start-up. Any "u-blox" banner
+		 * printed during power-up is discarded by the parser while it
+		 * looks for the "OK"
+		 */
+		_smutex.lock();
+
+		_parser->set_timeout(100);
+		_parser->flush();
+		_parser->send("AT");
+		bool ok = _parser->recv("OK");
+		_parser->set_timeout(_at_timeout_ms);
+
+		_smutex.unlock();
+
+		if(ok)
+		{
+			status = SaraN2::SARAN2_OK;
+			break;
+		}
+	}
+
+	bool warm = false;
+
+#if SARAN2_FEATURE_WARM_STATE
+	if(status == SaraN2::SARAN2_OK && _warm_state_given)
+	{
+		warm = restore_warm_state(_warm_state) == SaraN2::SARAN2_OK;
+	}
+#endif
+
+	if(status == SaraN2::SARAN2_OK && !warm && _configure_cb)
+	{
+		status = _configure_cb();
+	}
+
+	_boot_status = status;
+	_boot_flags.set(SARAN2_BOOT_DONE_FLAG);
+
+	if(_ready_cb)
+	{
+		_ready_cb(status);
+	}
 }
 
+#endif /* SARAN2_FEATURE_ASYNC_BOOT */
+
 /** Send "AT" command
  *
  * @return Indicates success or failure 
@@ -51,11 +236,15 @@ int SaraN2::at()
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
+	_command_start(COMMAND_AT);
 	_parser->send("AT");
-	if(!_parser->recv("OK"))
+	if(!_command_end(COMMAND_AT, _parser->recv("OK")))
 	{
+#if SARAN2_FEATURE_HEALTH
+		_health.timeouts++;
+#endif
 		_smutex.unlock();
 		return SaraN2::FAIL_AT;
 	}
@@ -77,10 +266,11 @@ int SaraN2::csq(int &power, int &quality)
 {
     _smutex.lock();
 
-    _parser->flush();
+    _wake_and_flush();
 
+    _command_start(COMMAND_CSQ);
     _parser->send("AT+CSQ");
-    if(!_parser->recv("+CSQ: %d,%d", &power, &quality))
+    if(!_command_end(COMMAND_CSQ, _parser->recv("+CSQ: %d,%d", &power, &quality)))
     {
         _smutex.unlock();
         return SaraN2::FAIL_CSQ;
@@ -91,6 +281,8 @@ int SaraN2::csq(int &power, int &quality)
     return SaraN2::SARAN2_OK;
 }
 
+#if SARAN2_FEATURE_PSM
+
 /** Retrieve current module PSM status
  * 
  * @param &psm Address of integer where PSM
@@ -101,7 +293,9 @@ int SaraN2::npsmr(int &psm)
 {
 	_smutex.lock();
 
-	_parser->flush();
+	int urc;
+
+	_wake_and_flush();
 
 	_parser->send("AT+NPSMR=1");
 	if(!_parser->recv("OK"))
@@ -110,8 +304,6 @@ int SaraN2::npsmr(int &psm)
 		return SaraN2::FAIL_SET_NPSMR_TRUE;
 	}
 
-	int urc;
-
 	_parser->send("AT+NPSMR?");
 	if(!_parser->recv("+NPSMR: %d,%d", &urc, &psm))
 	{
@@ -119,11 +311,23 @@ int SaraN2::npsmr(int &psm)
 		return SaraN2::FAIL_GET_NPSMR;
 	}
 
+#if SARAN2_FEATURE_HEALTH
+	if(_last_psm_state == 1 && psm == 0)
+	{
+		_health.psm_wakes++;
+	}
+	_last_psm_state = psm;
+#endif
+
 	_smutex.unlock();
 
 	return SaraN2::SARAN2_OK;
 }
 
+#endif /* SARAN2_FEATURE_PSM */
+
+#if SARAN2_FEATURE_COAP_PROFILES
+
 /** Select CoAP profile number, between 0-3
  *
  * @param profile Use enumerated values COAP_PROFILE_x to select profile
@@ -139,7 +343,7 @@ int SaraN2::select_profile(uint8_t profile)
 
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=3,\"%d\"", profile);
 	if(!_parser->recv("OK"))
@@ -148,6 +352,8 @@ int SaraN2::select_profile(uint8_t profile)
 		return SaraN2::FAIL_SELECT_PROFILE;
 	}
 
+	_coap_profile = profile;
+
 	_smutex.unlock();
 
 	return SaraN2::SARAN2_OK;
@@ -168,7 +374,7 @@ int SaraN2::load_profile(uint8_t profile)
 
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=5,\"%d\"", profile);
 	if(!_parser->recv("OK"))
@@ -177,6 +383,8 @@ int SaraN2::load_profile(uint8_t profile)
 		return SaraN2::FAIL_LOAD_PROFILE;
 	}
 
+	_coap_profile = profile;
+
 	_smutex.unlock();
 
 	return SaraN2::SARAN2_OK;
@@ -197,10 +405,11 @@ int SaraN2::save_profile(uint8_t profile)
 
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
+	_command_start(COMMAND_UCOAP_SAVE);
 	_parser->send("AT+UCOAP=6,\"%d\"", profile);
-	if(!_parser->recv("OK"))
+	if(!_command_end(COMMAND_UCOAP_SAVE, _parser->recv("OK")))
 	{
 		_smutex.unlock();
 		return SaraN2::FAIL_SAVE_PROFILE;
@@ -227,7 +436,7 @@ int SaraN2::set_profile_validity(uint8_t valid)
 
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=4,\"%d\"", valid);
 	if(!_parser->recv("OK"))
@@ -253,7 +462,7 @@ int SaraN2::set_coap_ip_port(char *ipv4, uint16_t port)
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=0,\"%s\",\"%d\"", ipv4, port);
 	if(!_parser->recv("OK"))
@@ -284,7 +493,7 @@ int SaraN2::set_coap_uri(char *uri, uint8_t uri_length)
 
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=1,\"%s\"", uri);
 	if(!_parser->recv("OK"))
@@ -306,7 +515,7 @@ int SaraN2::pdu_header_add_uri_host()
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=2,\"0\",\"1\"");
 	if(!_parser->recv("OK"))
@@ -328,7 +537,7 @@ int SaraN2::pdu_header_add_uri_port()
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=2,\"1\",\"1\"");
 	if(!_parser->recv("OK"))
@@ -350,7 +559,7 @@ int SaraN2::pdu_header_add_uri_path()
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=2,\"2\",\"1\"");
 	if(!_parser->recv("OK"))
@@ -372,7 +581,7 @@ int SaraN2::pdu_header_add_uri_query()
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=2,\"3\",\"1\"");
 	if(!_parser->recv("OK"))
@@ -394,7 +603,7 @@ int SaraN2::pdu_header_remove_uri_host()
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=2,\"0\",\"0\"");
 	if(!_parser->recv("OK"))
@@ -416,7 +625,7 @@ int SaraN2::pdu_header_remove_uri_port()
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=2,\"1\",\"0\"");
 	if(!_parser->recv("OK"))
@@ -438,7 +647,7 @@ int SaraN2::pdu_header_remove_uri_path()
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=2,\"2\",\"0\"");
 	if(!_parser->recv("OK"))
@@ -460,7 +669,7 @@ int SaraN2::pdu_header_remove_uri_query()
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAP=2,\"3\",\"0\"");
 	if(!_parser->recv("OK"))
@@ -484,7 +693,7 @@ int SaraN2::select_coap_at_interface()
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+USELCP=1");
 	if(!_parser->recv("OK"))
@@ -498,6 +707,10 @@ int SaraN2::select_coap_at_interface()
 	return SaraN2::SARAN2_OK;
 }
 
+#endif /* SARAN2_FEATURE_COAP_PROFILES */
+
+#if SARAN2_FEATURE_COAP
+
 /** Parse response from CoAP server into recv_data
  * 
  * @param *recv_data Pointer to a byte array where the data
@@ -506,73 +719,141 @@ int SaraN2::select_coap_at_interface()
  *                       will be stored
  * @param &more_block Address of integer where data more_block response
  *                    will be stored
- * @param timeout_ms Timeout value for the parser in milliseconds
+ * @param timeout_ms Timeout value for the parser in milliseconds, 0 
+ *                   uses the CoAP timeout of the operator profile
  * @return Indicates success or failure reason
  */
 int SaraN2::parse_coap_response(char *recv_data, int &response_code, int &more_block, uint16_t timeout)
 {
-	_parser->set_timeout(timeout);
+	const char *payload;
+	int payload_length;
+
+	_smutex.lock();
+
+	if(!_read_coap_response(response_code, more_block, timeout, payload, payload_length))
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_PARSE_RESPONSE;
+	}
+
+	/* The payload is kept as the hex characters sent by the module */
+	memcpy(recv_data, payload, (payload_length > SARAN2_MAX_COAP_PAYLOAD) ? SARAN2_MAX_COAP_PAYLOAD : payload_length);
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Parse response from CoAP server, decoding the hex payload on the 
+ *  AT interface with hex_decode() into binary data in recv_data
+ *
+ * @param *recv_data Pointer to a byte array of SARAN2_MAX_COAP_PAYLOAD
+ *                   bytes in which to store the decoded payload
+ * @param &recv_length Address of integer in which to store the
+ *                     decoded payload length
+ * @param &response_code Address of integer where CoAP operation response code
+ *                       will be stored
+ * @param &more_block Address of integer where data more_block response
+ *                    will be stored
+ * @param timeout_ms Timeout value for the parser in milliseconds, 0 
+ *                   uses the CoAP timeout of the operator profile
+ * @return Indicates success or failure reason. FAIL_PARSE_RESPONSE if
+ *         no response arrived or the payload is not valid hex
+ */
+int SaraN2::parse_coap_response(uint8_t *recv_data, size_t &recv_length, int &response_code, int &more_block, 
+                                uint16_t timeout)
+{
+	const char *payload;
+	int payload_length;
+
+	recv_length = 0;
+
+	_smutex.lock();
+
+	if(!_read_coap_response(response_code, more_block, timeout, payload, payload_length))
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_PARSE_RESPONSE;
+	}
+
+	if(payload_length > 2 * SARAN2_MAX_COAP_PAYLOAD)
+	{
+		payload_length = 2 * SARAN2_MAX_COAP_PAYLOAD;
+	}
+
+	int decoded = hex_decode(payload, payload_length & ~1, recv_data);
+
+	_smutex.unlock();
+
+	if(decoded < 0)
+	{
+		return SaraN2::FAIL_PARSE_RESPONSE;
+	}
+
+	recv_length = decoded;
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Read a +UCOAPCD response, leaving its hex payload in the line
+ *  buffer. Must be called with the driver lock held
+ *
+ * @param &response_code Address of integer where CoAP operation 
+ *                       response code will be stored
+ * @param &more_block Address of integer where data more_block 
+ *                    response will be stored
+ * @param timeout_ms Timeout value for the parser in milliseconds, 0 
+ *                   uses the CoAP timeout of the operator profile
+ * @param &payload Address of pointer in which to store the hex payload
+ * @param &payload_length Address of integer in which to store its length
+ * @return True if a response was read
+ */
+bool SaraN2::_read_coap_response(int &response_code, int &more_block, uint16_t timeout, 
+                                 const char *&payload, int &payload_length)
+{
+	payload = _line_buffer;
+	payload_length = 0;
+
+	_parser->set_timeout((timeout != 0) ? timeout : _coap_timeout_ms);
 
     if(_parser->recv("+UCOAPCD: %d", &response_code))
     {
+        _timeline_mark(&CoapTimeline_t::response);
+
         _parser->set_timeout(100);
 
-        uint16_t buffer_index = 0;
-        int capture_byte = -1;
-        int more_block_byte = -1;
+        /* The remainder of the line is ,"<payload>",<more_block> */
+        const char *fields[3];
+        int lengths[3];
+
+        int length = _read_line(_line_buffer, sizeof(_line_buffer));
+        int count = (length > 0) ? _split_fields(_line_buffer, length, fields, lengths, 3) : 0;
+
+        if(count >= 2)
+        {
+            payload = fields[1];
+            payload_length = lengths[1];
+        }
 
-        /* Max recv_data payload size is 512 bytes so allow for more_block and a 
-         * a few bytes to spare 
-         */
-        for(int i = 0; i < 520; i++)
+        if(count >= 3 && lengths[2] > 0)
         {
-            int byte = _parser->getc();
-
-            if(byte == -1)
-            {
-                break;
-            }
-
-            if(byte == 34) // ASCII for "
-            {
-                // Start of payload
-                if(capture_byte == -1)
-                {
-                    capture_byte = i + 1;
-                    buffer_index = 0;
-                    continue;
-                }
-                // End of payload
-                else
-                {
-                    more_block_byte = i + 2;
-                    capture_byte = -2;
-                    continue;
-                }
-            }
-
-            if(capture_byte == i)
-            {
-                memcpy(&recv_data[buffer_index], &byte, 1);
-                buffer_index++;
-                capture_byte++;
-            }
-
-            if(more_block_byte == i)
-            {
-                more_block = byte;
-                break;
-            }
+            more_block = fields[2][0];
         }
 
-        _parser->set_timeout(500);
+        _timeline_mark(&CoapTimeline_t::parsed);
 
-        return SaraN2::SARAN2_OK;   
+        _parser->set_timeout(_at_timeout_ms);
+
+        return true;
     }
 
-	_parser->set_timeout(500);
+	_parser->set_timeout(_at_timeout_ms);
+
+#if SARAN2_FEATURE_HEALTH
+	_health.timeouts++;
+#endif
 
-	return SaraN2::FAIL_PARSE_RESPONSE;
+	return false;
 }
 
 /** Perform a GET request using CoAP and save the returned 
@@ -586,27 +867,47 @@ int SaraN2::parse_coap_response(char *recv_data, int &response_code, int &more_b
  */ 
 int SaraN2::coap_get(char *recv_data, int &response_code)
 {
+	uint64_t start = Kernel::get_ms_count();
+
 	_smutex.lock();
 
-	_parser->flush();
+	if(_backoff_active())
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_BACKOFF_ACTIVE;
+	}
+
+	if(!_take_uplink_token())
+	{
+		_smutex.unlock();
+		return SaraN2::UPLINK_RATE_LIMITED;
+	}
+
+	_timeline_start();
+
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAPC=1");
+	_timeline_mark(&CoapTimeline_t::write_end);
+
 	if(!_parser->recv("OK"))
 	{
 		_smutex.unlock();
-		return SaraN2::FAIL_START_GET_REQUEST;
+		return _finish_coap_request(start, SaraN2::FAIL_START_GET_REQUEST);
 	}
 
+	_timeline_mark(&CoapTimeline_t::accepted);
+
     int more_block = -1;
 	if(parse_coap_response(recv_data, response_code, more_block) != SaraN2::SARAN2_OK)
 	{
 		_smutex.unlock();
-		return SaraN2::FAIL_PARSE_RESPONSE;
+		return _finish_coap_request(start, SaraN2::FAIL_PARSE_RESPONSE);
 	}
 
 	_smutex.unlock();
 
-	return SaraN2::SARAN2_OK;
+	return _finish_coap_request(start, SaraN2::SARAN2_OK);
 }
 
 /** Perform a DELETE request using CoAP and save the returned 
@@ -620,27 +921,47 @@ int SaraN2::coap_get(char *recv_data, int &response_code)
  */ 
 int SaraN2::coap_delete(char *recv_data, int &response_code)
 {
+	uint64_t start = Kernel::get_ms_count();
+
 	_smutex.lock();
 
-	_parser->flush();
+	if(_backoff_active())
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_BACKOFF_ACTIVE;
+	}
+
+	if(!_take_uplink_token())
+	{
+		_smutex.unlock();
+		return SaraN2::UPLINK_RATE_LIMITED;
+	}
+
+	_timeline_start();
+
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAPC=2");
+	_timeline_mark(&CoapTimeline_t::write_end);
+
 	if(!_parser->recv("OK"))
 	{
 		_smutex.unlock();
-		return SaraN2::FAIL_START_DELETE_REQUEST;
+		return _finish_coap_request(start, SaraN2::FAIL_START_DELETE_REQUEST);
 	}
 
+	_timeline_mark(&CoapTimeline_t::accepted);
+
     int more_block = -1;
 	if(parse_coap_response(recv_data, response_code, more_block) != SaraN2::SARAN2_OK)
 	{
 		_smutex.unlock();
-		return SaraN2::FAIL_PARSE_RESPONSE;
+		return _finish_coap_request(start, SaraN2::FAIL_PARSE_RESPONSE);
 	}
 
 	_smutex.unlock();
 
-	return SaraN2::SARAN2_OK;
+	return _finish_coap_request(start, SaraN2::SARAN2_OK);
 }
 
 /** Perform a PUT request using CoAP and save the returned 
@@ -659,27 +980,47 @@ int SaraN2::coap_delete(char *recv_data, int &response_code)
  */ 
 int SaraN2::coap_put(char *send_data, char *recv_data, int data_indentifier, int &response_code)
 {
+	uint64_t start = Kernel::get_ms_count();
+
 	_smutex.lock();
 
-	_parser->flush();
+	if(_backoff_active())
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_BACKOFF_ACTIVE;
+	}
+
+	if(!_take_uplink_token())
+	{
+		_smutex.unlock();
+		return SaraN2::UPLINK_RATE_LIMITED;
+	}
+
+	_timeline_start();
+
+	_wake_and_flush();
 
 	_parser->send("AT+UCOAPC=3,\"%s\",%i", send_data, data_indentifier);
+	_timeline_mark(&CoapTimeline_t::write_end);
+
 	if(!_parser->recv("OK"))
 	{
 		_smutex.unlock();
-		return SaraN2::FAIL_START_PUT_REQUEST;
+		return _finish_coap_request(start, SaraN2::FAIL_START_PUT_REQUEST);
 	}
 
+	_timeline_mark(&CoapTimeline_t::accepted);
+
     int more_block = -1;
 	if(parse_coap_response(recv_data, response_code, more_block) != SaraN2::SARAN2_OK)
 	{
 		_smutex.unlock();
-		return SaraN2::FAIL_PARSE_RESPONSE;
+		return _finish_coap_request(start, SaraN2::FAIL_PARSE_RESPONSE);
 	}
 
 	_smutex.unlock();
 
-	return SaraN2::SARAN2_OK;
+	return _finish_coap_request(start, SaraN2::SARAN2_OK);
 }
 
 /** Perform a POST request using CoAP and save the returned 
@@ -698,83 +1039,252 @@ int SaraN2::coap_put(char *send_data, char *recv_data, int data_indentifier, int
  */ 
 int SaraN2::coap_post(uint8_t* send_data, size_t buffer_len, char *recv_data, int data_indentifier, uint8_t send_block_number, uint8_t send_more_block, int &response_code)
 {
-    stringstream ss; //stringstream works but it's taking huge amount in flash memory
-    for(int i=0; i<buffer_len; ++i)
-    {
-        ss << hex << (int)send_data[i];
-    }   
-    string mystr = ss.str();
+	uint64_t start = Kernel::get_ms_count();
 
 	_smutex.lock();
 
-	_parser->flush();
+	if(_backoff_active())
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_BACKOFF_ACTIVE;
+	}
+
+	if(!_take_uplink_token())
+	{
+		_smutex.unlock();
+		return SaraN2::UPLINK_RATE_LIMITED;
+	}
+
+	_timeline_start();
+
+	_wake_and_flush();
 
-    _parser->send("AT+UCOAPC=4,\"%s\",%i", mystr.c_str(), data_indentifier); 
+    _parser->printf("AT+UCOAPC=4,\"");
+    _write_hex(send_data, buffer_len);
+#if SARAN2_FEATURE_HEALTH
+    /* Only opaque payloads can carry the record, since appending it to a
+     * JSON or CBOR body would make the body invalid
+     */
+    bool piggyback = _health_interval_s != 0 && data_indentifier == SaraN2::APPLICATION_OCTET &&
+                     (_health_last_sent_ms == 0 || start - _health_last_sent_ms >= (uint64_t)_health_interval_s * 1000);
+    if(piggyback)
+    {
+        uint8_t record[SARAN2_HEALTH_RECORD_SIZE];
+        size_t record_length;
+
+        piggyback = encode_health_record(record, sizeof(record), record_length) == SaraN2::SARAN2_OK &&
+                    buffer_len + record_length <= SARAN2_MAX_COAP_PAYLOAD;
+
+        if(piggyback)
+        {
+            _write_hex(record, record_length);
+        }
+    }
+#endif
+    _parser->printf("\",%i\r\n", data_indentifier);
+    _timeline_mark(&CoapTimeline_t::write_end);
 
     if(!_parser->recv("OK"))
 	{
 		_smutex.unlock();
         
-		return SaraN2::FAIL_START_POST_REQUEST;
+		return _finish_coap_request(start, SaraN2::FAIL_START_POST_REQUEST);
 	}
 
+	_timeline_mark(&CoapTimeline_t::accepted);
+
     int more_block = -1;
 	if(parse_coap_response(recv_data, response_code, more_block) != SaraN2::SARAN2_OK)
 	{
 		_smutex.unlock();
-		return SaraN2::FAIL_PARSE_RESPONSE;
+		return _finish_coap_request(start, SaraN2::FAIL_PARSE_RESPONSE);
 	}
 
+#if SARAN2_FEATURE_HEALTH
+    if(piggyback)
+    {
+        _health_last_sent_ms = start;
+    }
+#endif
+
 	_smutex.unlock();
 
-	return SaraN2::SARAN2_OK;
+	return _finish_coap_request(start, SaraN2::SARAN2_OK);
 }
 
-/** Reboots the module. After receiving the 'REBOOTING' response, no further
- *  AT commands will be processed until the module has successfully power on
+#endif /* SARAN2_FEATURE_COAP */
+
+#if SARAN2_FEATURE_COAP_METHODS
+
+/** Set the server and resource used by coap_fetch(), coap_patch() and
+ *  coap_ipatch(). AT+UCOAPC only supports GET, DELETE, PUT and POST,
+ *  so these methods are sent as CoAP messages on a module UDP socket
+ *  and do not use the CoAP profile
  *
- * @return Indicates success or failure reason
+ * @param *ipv4 Pointer to the server IPv4 address string
+ * @param port Server port, normally 5683
+ * @param *path Pointer to the resource path, i.e. "state/device"
+ * @return Indicates success or failure reason. INVALID_COAP_ADDRESS
+ *         if ipv4 is not a dotted-quad IPv4 address
  */
-int SaraN2::reboot_module()
+int SaraN2::set_coap_socket_target(const char *ipv4, uint16_t port, const char *path)
 {
-	_smutex.lock();
-
-	_parser->flush();
+	unsigned int octets[4];
+	char end;
 
-	_parser->send("AT+NRB");
-	if(_parser->recv("REBOOTING"))
+	if(strlen(ipv4) >= sizeof(_coap_target_ip) ||
+	   sscanf(ipv4, "%3u.%3u.%3u.%3u%c", &octets[0], &octets[1], &octets[2], &octets[3], &end) != 4 ||
+	   octets[0] > 255 || octets[1] > 255 || octets[2] > 255 || octets[3] > 255)
 	{
-		_parser->set_timeout(10000);
+		return SaraN2::INVALID_COAP_ADDRESS;
+	}
 
-        if(_parser->recv("u-blox") && _parser->recv("OK"))
-        {
-            _parser->set_timeout(500);
-            _smutex.unlock();
-            return SaraN2::SARAN2_OK;
-        }
-        else
-        {
-            _parser->set_timeout(500);
-            _smutex.unlock();
-            return SaraN2::FAIL_REBOOT;
-        }
+	if(strlen(path) >= sizeof(_coap_target_path))
+	{
+		return SaraN2::COAP_PATH_TOO_LONG;
 	}
-    else
-    {
-        _smutex.unlock();
-		return SaraN2::FAIL_REBOOT;
-    }
-}
 
-/** Enable module Power Save Mode (PSM)
- * 
+	_smutex.lock();
+
+	strcpy(_coap_target_ip, ipv4);
+	strcpy(_coap_target_path, path);
+	_coap_target_port = port;
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Perform a FETCH request (RFC 8132), returning only the parts of 
+ *  the resource selected by the request body
+ *
+ * @param *send_data Pointer to the request body, i.e. a query
+ * @param length Number of bytes in the request body
+ * @param content_format CoAP Content-Format of the body, i.e.
+ *                       COAP_FORMAT_JSON
+ * @param *recv_data Pointer to a byte array of SARAN2_MAX_COAP_PAYLOAD
+ *                   bytes in which to store the response payload
+ * @param &recv_length Address of integer in which to store the
+ *                     response payload length
+ * @param &response_code Address of integer where the CoAP response 
+ *                       class will be stored, i.e. SUCCESS
+ * @return Indicates success or failure reason. COAP_RESPONSE_TRUNCATED
+ *         if only the first SARAN2_COAP_SOCKET_READ bytes of the 
+ *         response were kept, COAP_RESET_RECEIVED if the server 
+ *         rejected the request with a RST
+ */
+int SaraN2::coap_fetch(const uint8_t *send_data, size_t length, uint16_t content_format, 
+                       uint8_t *recv_data, size_t &recv_length, int &response_code)
+{
+	return _coap_socket_request(0x05, SaraN2::FAIL_START_FETCH_REQUEST, send_data, length, 
+	                            content_format, recv_data, recv_length, response_code);
+}
+
+/** Perform a PATCH request (RFC 8132), applying the changes in the
+ *  request body to the resource. PATCH is not idempotent
+ *
+ * @param *send_data Pointer to the request body, i.e. a JSON patch
+ * @param length Number of bytes in the request body
+ * @param content_format CoAP Content-Format of the body, i.e.
+ *                       COAP_FORMAT_JSON_PATCH
+ * @param *recv_data Pointer to a byte array of SARAN2_MAX_COAP_PAYLOAD
+ *                   bytes in which to store the response payload
+ * @param &recv_length Address of integer in which to store the
+ *                     response payload length
+ * @param &response_code Address of integer where the CoAP response 
+ *                       class will be stored, i.e. SUCCESS
+ * @return Indicates success or failure reason. COAP_RESPONSE_TRUNCATED
+ *         if only the first SARAN2_COAP_SOCKET_READ bytes of the 
+ *         response were kept, COAP_RESET_RECEIVED if the server 
+ *         rejected the request with a RST
+ */
+int SaraN2::coap_patch(const uint8_t *send_data, size_t length, uint16_t content_format, 
+                       uint8_t *recv_data, size_t &recv_length, int &response_code)
+{
+	return _coap_socket_request(0x06, SaraN2::FAIL_START_PATCH_REQUEST, send_data, length, 
+	                            content_format, recv_data, recv_length, response_code);
+}
+
+/** Perform an iPATCH request (RFC 8132), the idempotent form of
+ *  PATCH, i.e. with a merge patch that sets fields to new values
+ *
+ * @param *send_data Pointer to the request body
+ * @param length Number of bytes in the request body
+ * @param content_format CoAP Content-Format of the body, i.e.
+ *                       COAP_FORMAT_MERGE_PATCH_JSON
+ * @param *recv_data Pointer to a byte array of SARAN2_MAX_COAP_PAYLOAD
+ *                   bytes in which to store the response payload
+ * @param &recv_length Address of integer in which to store the
+ *                     response payload length
+ * @param &response_code Address of integer where the CoAP response 
+ *                       class will be stored, i.e. SUCCESS
+ * @return Indicates success or failure reason. COAP_RESPONSE_TRUNCATED
+ *         if only the first SARAN2_COAP_SOCKET_READ bytes of the 
+ *         response were kept, COAP_RESET_RECEIVED if the server 
+ *         rejected the request with a RST
+ */
+int SaraN2::coap_ipatch(const uint8_t *send_data, size_t length, uint16_t content_format, 
+                        uint8_t *recv_data, size_t &recv_length, int &response_code)
+{
+	return _coap_socket_request(0x07, SaraN2::FAIL_START_IPATCH_REQUEST, send_data, length, 
+	                            content_format, recv_data, recv_length, response_code);
+}
+
+#endif /* SARAN2_FEATURE_COAP_METHODS */
+
+/** Reboots the module. After receiving the 'REBOOTING' response, no further
+ *  AT commands will be processed until the module has successfully power on
+ *
+ * @return Indicates success or failure reason
+ */
+int SaraN2::reboot_module()
+{
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	_parser->send("AT+NRB");
+	if(_parser->recv("REBOOTING"))
+	{
+		_parser->set_timeout(10000);
+
+        if(_parser->recv("u-blox") && _parser->recv("OK"))
+        {
+#if SARAN2_FEATURE_COAP_METHODS
+            _coap_socket = -1;
+#endif
+#if SARAN2_FEATURE_HEALTH
+            _health.reboots++;
+#endif
+            _parser->set_timeout(_at_timeout_ms);
+            _smutex.unlock();
+            return SaraN2::SARAN2_OK;
+        }
+        else
+        {
+            _parser->set_timeout(_at_timeout_ms);
+            _smutex.unlock();
+            return SaraN2::FAIL_REBOOT;
+        }
+	}
+    else
+    {
+        _smutex.unlock();
+		return SaraN2::FAIL_REBOOT;
+    }
+}
+
+#if SARAN2_FEATURE_PSM
+
+/** Enable module Power Save Mode (PSM)
+ * 
  * @return Indicates success or failure reason
  */
 int SaraN2::enable_power_save_mode()
 {
 	_smutex.lock();
 	
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+CPSMS=1");
 	if(!_parser->recv("OK"))
@@ -783,6 +1293,8 @@ int SaraN2::enable_power_save_mode()
 		return SaraN2::FAIL_ENABLE_PSM;
 	}
 
+	_requested_psm = 1;
+
 	_smutex.unlock();
 
 	return SaraN2::SARAN2_OK;
@@ -796,7 +1308,7 @@ int SaraN2::disable_power_save_mode()
 {
 	_smutex.lock();
 	
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+CPSMS=0");
 	if(!_parser->recv("OK"))
@@ -805,6 +1317,8 @@ int SaraN2::disable_power_save_mode()
 		return SaraN2::FAIL_DISABLE_PSM;
 	}
 
+	_requested_psm = 0;
+
 	_smutex.unlock();
 
 	return SaraN2::SARAN2_OK;
@@ -822,7 +1336,7 @@ int SaraN2::query_power_save_mode(int &power_save_mode)
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+CPSMS?");
 	if(!_parser->recv("+CPSMS: %d", &power_save_mode) || !_parser->recv("OK"))
@@ -838,7 +1352,7 @@ int SaraN2::query_power_save_mode(int &power_save_mode)
 
 /** Set the T3412 timer. The AT command requires that the PSM and
  *  T3324 settings are specified also, so the current values for 
- *  these settings are determined and reused
+ *  these settings are determined and reused within the same lock
  * 
  * @param *timer Char array containing 8-bit binary string conforming
  *               to 3GPP TS 24.008 GPRS Timer 3 definition
@@ -847,30 +1361,29 @@ int SaraN2::query_power_save_mode(int &power_save_mode)
 int SaraN2::set_t3412_timer(char *timer)
 {
     int psm;
+    char t3412[10];
     char t3324[10];
 
-    int status = query_power_save_mode(psm);
-    if(status != SaraN2::SARAN2_OK)
-    {
-        return status;
-    }
+    _smutex.lock();
+
+    _wake_and_flush();
 
-    status = get_t3324_timer(t3324);
-    if(status != SaraN2::SARAN2_OK)
+    if(!_read_psm_settings(psm, t3412, t3324))
     {
-        return status;
+        _smutex.unlock();
+        return SaraN2::FAIL_QUERY_PSM;
     }
 
-    _smutex.lock();
-
-    _parser->flush();
-
     _parser->send("AT+CPSMS=%d,,,\"%s\",\"%s\"", psm, timer, t3324);
     if(!_parser->recv("OK"))
     {
         _smutex.unlock();
         return SaraN2::FAIL_SET_T3412;
     }
+
+    strncpy(_requested_t3412, timer, 8);
+    strncpy(_requested_t3324, t3324, 8);
+    _requested_psm = psm;
 	
     _smutex.unlock();
 
@@ -891,7 +1404,7 @@ int SaraN2::get_t3412_timer(char *timer)
 
     _smutex.lock();
 
-    _parser->flush();
+    _wake_and_flush();
 
     _parser->send("AT+CPSMS?");
     if(_parser->recv("+CPSMS: %d,,,\"%8s\", \"%8s\"", &psm, timer, t3324) &&
@@ -910,39 +1423,38 @@ int SaraN2::get_t3412_timer(char *timer)
 
 /** Set the T3324 timer. The AT command requires that the PSM and
  *  T3412 settings are specified also, so the current values for 
- *  these settings are determined and reused
+ *  these settings are determined and reused within the same lock
  * 
  * @param *timer Char array containing 8-bit binary string conforming
  *               to 3GPP TS 24.008 GPRS Timer 2 definition
  * @return Indicates success or failure reason
  */
 int SaraN2::set_t3324_timer(char *timer)
-{	
+{
     int psm;
     char t3412[10];
+    char t3324[10];
 
-    int status = query_power_save_mode(psm);
-    if(status != SaraN2::SARAN2_OK)
-    {
-        return status;
-    }
+    _smutex.lock();
 
-    status = get_t3412_timer(t3412);
-    if(status != SaraN2::SARAN2_OK)
+    _wake_and_flush();
+
+    if(!_read_psm_settings(psm, t3412, t3324))
     {
-        return status;
+        _smutex.unlock();
+        return SaraN2::FAIL_QUERY_PSM;
     }
 
-    _smutex.lock();
-
-    _parser->flush();
-
     _parser->send("AT+CPSMS=%d,,,\"%s\",\"%s\"", psm, t3412, timer);
     if(!_parser->recv("OK"))
     {
         _smutex.unlock();
         return SaraN2::FAIL_SET_T3324;
     }
+
+    strncpy(_requested_t3412, t3412, 8);
+    strncpy(_requested_t3324, timer, 8);
+    _requested_psm = psm;
 	
     _smutex.unlock();
 
@@ -963,7 +1475,7 @@ int SaraN2::get_t3324_timer(char *timer)
 
     _smutex.lock();
 
-    _parser->flush();
+    _wake_and_flush();
 
     _parser->send("AT+CPSMS?");
     if(_parser->recv("+CPSMS: %d,,,\"%8s\",\"%8s\"", &psm, t3412, timer) &&
@@ -980,6 +1492,112 @@ int SaraN2::get_t3324_timer(char *timer)
     return SaraN2::FAIL_GET_T3324;
 }
 
+/** Read the PSM timers granted by the network from a +CEREG level 4
+ *  report. The network may grant different values to those requested
+ *  or refuse PSM altogether, in which case granted is set to 0
+ *
+ * @param *active_time Pointer to Char array of at least 9 bytes in which
+ *                     to store the granted T3324 binary string, empty if
+ *                     none was granted
+ * @param *periodic_tau Pointer to Char array of at least 9 bytes in which 
+ *                      to store the granted T3412 binary string, empty if 
+ *                      none was granted
+ * @param &granted Address of integer in which to store 1 if PSM was 
+ *                 granted, otherwise 0
+ * @return Indicates success or failure reason
+ */
+int SaraN2::get_granted_psm_timers(char *active_time, char *periodic_tau, int &granted)
+{
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	if(!_read_cereg_report())
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_GET_GRANTED_PSM;
+	}
+
+	strcpy(active_time, _granted_t3324);
+	strcpy(periodic_tau, _granted_t3412);
+	granted = _psm_granted ? 1 : 0;
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Retrieve the PSM setting and timers last requested through this 
+ *  driver. This does not communicate with the module
+ *
+ * @param *t3324 Pointer to Char array of at least 9 bytes in which to
+ *               store the requested T3324 binary string
+ * @param *t3412 Pointer to Char array of at least 9 bytes in which to
+ *               store the requested T3412 binary string
+ * @param &enabled Address of integer in which to store 1 if PSM was
+ *                 requested, otherwise 0
+ */
+void SaraN2::get_requested_psm_timers(char *t3324, char *t3412, int &enabled)
+{
+	_smutex.lock();
+
+	strcpy(t3324, _requested_t3324);
+	strcpy(t3412, _requested_t3412);
+	enabled = _requested_psm;
+
+	_smutex.unlock();
+}
+
+/** When enabled and the network has not granted PSM, according to the 
+ *  last get_granted_psm_timers(), begin_uplink_burst() and 
+ *  end_uplink_burst() power the RF circuitry up and down around 
+ *  uplinks so that idle current stays close to that of PSM
+ *
+ * @param enable True to enable CFUN duty-cycling, false to disable
+ */
+void SaraN2::set_psm_fallback(bool enable)
+{
+	_psm_fallback = enable;
+}
+
+/** Call before a burst of uplinks. Activates the radio if the PSM 
+ *  fallback is in effect, otherwise does nothing
+ *
+ * @return Indicates success or failure reason
+ */
+int SaraN2::begin_uplink_burst()
+{
+#if SARAN2_FEATURE_RADIO
+	if(_psm_fallback_active())
+	{
+		return activate_radio();
+	}
+#endif
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Call after a burst of uplinks. Deactivates the radio if the PSM
+ *  fallback is in effect, otherwise does nothing
+ *
+ * @return Indicates success or failure reason
+ */
+int SaraN2::end_uplink_burst()
+{
+#if SARAN2_FEATURE_RADIO
+	if(_psm_fallback_active())
+	{
+		return deactivate_radio();
+	}
+#endif
+
+	return SaraN2::SARAN2_OK;
+}
+
+#endif /* SARAN2_FEATURE_PSM */
+
+#if SARAN2_FEATURE_NCONFIG
+
 /** Configure customisable aspects of the UE given the functions and values
  *  available in the enumerated list of AT+NCONFIG functions and values
  * 
@@ -991,7 +1609,7 @@ int SaraN2::configure_ue(uint8_t function, uint8_t value)
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+NCONFIG=\"%s\",\"%s\"", config_functions[function], config_values[value]);
 	if(!_parser->recv("OK"))
@@ -1000,11 +1618,18 @@ int SaraN2::configure_ue(uint8_t function, uint8_t value)
 		return SaraN2::FAIL_CONFIGURE_UE;
 	}
 
+	_nconfig_mask |= 1 << function;
+	_nconfig_values = (_nconfig_values & ~(1 << function)) | ((value & 1) << function);
+
 	_smutex.unlock();
 
 	return SaraN2::SARAN2_OK;
 }
 
+#endif /* SARAN2_FEATURE_NCONFIG */
+
+#if SARAN2_FEATURE_RADIO
+
 /** Determine whether +CEREG URC is enabled and the current
  *  network registration status of the device
  *
@@ -1017,7 +1642,7 @@ int SaraN2::cereg(int &urc, int &status)
 {
     _smutex.lock();
 
-    _parser->flush();
+    _wake_and_flush();
 
 	_parser->send("AT+CEREG=0");
 	if(!_parser->recv("OK"))
@@ -1026,13 +1651,39 @@ int SaraN2::cereg(int &urc, int &status)
 		return SaraN2::FAIL_SET_CEREG_0;
 	}
 
+    _command_start(COMMAND_CEREG);
     _parser->send("AT+CEREG?");
-    if(!_parser->recv("+CEREG: %d,%d", &urc, &status) || !_parser->recv("OK"))
+    if(!_command_end(COMMAND_CEREG, _parser->recv("+CEREG: %d,%d", &urc, &status)) || !_parser->recv("OK"))
     {
         _smutex.unlock();
         return SaraN2::FAIL_GET_CEREG;
     }
 
+    if(status == SaraN2::REGISTRATION_DENIED)
+    {
+        _check_registration_reject();
+    }
+#if SARAN2_FEATURE_BACKOFF
+    else if(status == SaraN2::REGISTERED_HOME_NETWORK || status == SaraN2::REGISTERED_ROAMING)
+    {
+        _backoff_until_ms = 0;
+        _backoff_rejects = 0;
+    }
+#endif
+
+#if SARAN2_FEATURE_OPERATOR_PROFILES
+    bool registered = status == SaraN2::REGISTERED_HOME_NETWORK || status == SaraN2::REGISTERED_ROAMING;
+
+    if(!registered)
+    {
+        _operator_profile_applied = false;
+    }
+    else if(_operator_profile_auto && !_operator_profile_applied)
+    {
+        apply_operator_profile();
+    }
+#endif
+
     _smutex.unlock();
 
     return SaraN2::SARAN2_OK;
@@ -1049,8 +1700,23 @@ int SaraN2::cscon(int &urc, int &connected)
 {
     _smutex.lock();
 
-    _parser->flush();
+    _wake_and_flush();
+
+#if SARAN2_FEATURE_TIMELINE
+    /* The +CSCON oob consumes the response line, see _cscon_urc() */
+    _cscon_reply_valid = false;
+
+    _parser->send("AT+CSCON?");
+
+    if(!_parser->recv("OK") || !_cscon_reply_valid)
+    {
+        _smutex.unlock();
+        return SaraN2::FAIL_GET_CSCON;
+    }
 
+    urc = _cscon_reply[0];
+    connected = _cscon_reply[1];
+#else
     _parser->send("AT+CSCON?");
 
     if(!_parser->recv("+CSCON: %d,%d", &urc, &connected) || !_parser->recv("OK"))
@@ -1058,11 +1724,17 @@ int SaraN2::cscon(int &urc, int &connected)
         _smutex.unlock();
         return SaraN2::FAIL_GET_CSCON;
     }
+#endif
+
     _smutex.unlock();
 
     return SaraN2::SARAN2_OK;
 }
 
+#endif /* SARAN2_FEATURE_RADIO */
+
+#if SARAN2_FEATURE_STATS
+
 /** Return operation stats, of a given type, of the module
  * 
  * @param *data Point to .data parameter of Nuestats_t struct
@@ -1073,63 +1745,139 @@ int SaraN2::nuestats(char *data)
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+NUESTATS");
 
-    int capture_byte = -1;
-    char buffer[16];
-    uint8_t buffer_index = 0;
     int parameter = 0;
 
     _parser->set_timeout(100);
 
-    for(int i = 0; i < 200; i++)
+    /* Each line is of the form NUESTATS: "RADIO","<name>",<value>, so only
+     * the last field of a line is of interest
+     */
+    while(parameter < SARAN2_NUESTATS_PARAMETERS)
     {
-        int byte = _parser->getc();
+        int length = _read_line(_line_buffer, sizeof(_line_buffer));
 
-        if(byte == -1) // No more data in buffer
+        if(length < 0 || strcmp(_line_buffer, "OK") == 0) // No more data in buffer
         {
             break;
         }
-        else if(byte == 44) // Comma
-        {
-            capture_byte = i + 1;
-            buffer_index = 0;
-            continue;
-        }
-        else if(byte == 13 && buffer_index > 0) // CR
-        {
-            int value = atoi(buffer);
-            memcpy(&data[4 * parameter], &value, sizeof(int));
-            memset(buffer, 0, sizeof(buffer));
-            parameter++;
 
-            capture_byte = -1;
-            buffer_index = 0;
+        const char *fields[4];
+        int lengths[4];
 
-            continue;
-        }
-        else if(byte == 10) // LF
+        int count = _split_fields(_line_buffer, length, fields, lengths, 4);
+        if(count < 2 || lengths[count - 1] == 0)
         {
             continue;
         }
 
-        if(capture_byte == i)
-        {
-            memcpy(&buffer[buffer_index], &byte, 1);
-            buffer_index++;
-            capture_byte++;
-        }
+        int value = strtol(fields[count - 1], NULL, 10);
+        memcpy(&data[4 * parameter], &value, sizeof(int));
+        parameter++;
     }
 
+    _parser->set_timeout(_at_timeout_ms);
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+#endif /* SARAN2_FEATURE_STATS */
+
+#if SARAN2_FEATURE_SURVEY
+
+/** Read the serving cell radio measurements for a coverage survey 
+ *  with a single AT+NUESTATS="RADIO". Returns as soon as the final
+ *  OK arrives, so it can be called at the module's reporting rate.
+ *  The position fields are left for the application to fill in
+ *  before the sample is appended to a SaraN2SurveyLog
+ *
+ * @param &sample Address of SaraN2SurveyLog::Sample_t in which to 
+ *                store the measurements and timestamp
+ * @return Indicates success or failure reason
+ */
+int SaraN2::survey_sample(SaraN2SurveyLog::Sample_t &sample)
+{
+	/* Parameter names of NUESTATS: "RADIO","<name>",<value> lines */
+	enum { SIGNAL, TOTAL, TX, CELL, ECL, SNR, EARFCN, PCI, RSRQ, COUNT };
+	static const char *const names[COUNT] =
+	{
+		"Signal power", "Total power", "TX power", "Cell ID", "ECL", "SNR", "EARFCN", "PCI", "RSRQ"
+	};
+
+	int32_t values[COUNT];
+	uint16_t seen = 0;
+	bool ok = false;
+
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	_parser->send("AT+NUESTATS=\"RADIO\"");
+
+	while(true)
+	{
+		int length = _read_line(_line_buffer, sizeof(_line_buffer));
+
+		if(length < 0)
+		{
+			break;
+		}
+
+		if(strcmp(_line_buffer, "OK") == 0)
+		{
+			ok = true;
+			break;
+		}
+
+		const char *fields[3];
+		int lengths[3];
+
+		if(_split_fields(_line_buffer, length, fields, lengths, 3) < 3)
+		{
+			continue;
+		}
+
+		for(int i = 0; i < COUNT; i++)
+		{
+			if(lengths[1] == (int)strlen(names[i]) && strncmp(fields[1], names[i], lengths[1]) == 0)
+			{
+				values[i] = strtol(fields[2], NULL, 10);
+				seen |= 1 << i;
+				break;
+			}
+		}
+	}
+
 	_smutex.unlock();
 
-    _parser->set_timeout(500);
+	if(!ok || seen != (1 << COUNT) - 1)
+	{
+		return SaraN2::FAIL_GET_SURVEY_SAMPLE;
+	}
+
+	sample.time_ms = Kernel::get_ms_count();
+	sample.signal_power = values[SIGNAL];
+	sample.total_power = values[TOTAL];
+	sample.tx_power = values[TX];
+	sample.cell_id = values[CELL];
+	sample.ecl = values[ECL];
+	sample.snr = values[SNR];
+	sample.earfcn = values[EARFCN];
+	sample.pci = values[PCI];
+	sample.rsrq = values[RSRQ];
 
 	return SaraN2::SARAN2_OK;
 }
 
+#endif /* SARAN2_FEATURE_SURVEY */
+
+#if SARAN2_FEATURE_RADIO
+
 /** Is the TX/RX circuitry turned on or off? 1 is on, 0 is off
  * 
  * @param &status Address of integer value to which to return the status
@@ -1140,7 +1888,7 @@ int SaraN2::get_radio_status(int &status)
 {
 	_smutex.lock();
 
-	_parser->flush();
+	_wake_and_flush();
 
 	_parser->send("AT+CFUN?");
 	if(!_parser->recv("+CFUN: %d", &status) || !_parser->recv("OK"))
@@ -1162,10 +1910,11 @@ int SaraN2::deactivate_radio()
 {
     _smutex.lock();
 
-    _parser->flush();
+    _wake_and_flush();
 
+    _command_start(COMMAND_CFUN);
     _parser->send("AT+CFUN=0");
-    if(!_parser->recv("OK"))
+    if(!_command_end(COMMAND_CFUN, _parser->recv("OK")))
     {
         _smutex.unlock();
         return SaraN2::FAIL_DEACTIVATE_RADIO;
@@ -1184,10 +1933,11 @@ int SaraN2::activate_radio()
 {
     _smutex.lock();
 
-    _parser->flush();
+    _wake_and_flush();
 
+    _command_start(COMMAND_CFUN);
     _parser->send("AT+CFUN=1");
-    if(!_parser->recv("OK"))
+    if(!_command_end(COMMAND_CFUN, _parser->recv("OK")))
     {
         _smutex.unlock();
         return SaraN2::FAIL_ACTIVATE_RADIO;
@@ -1206,15 +1956,36 @@ int SaraN2::gprs_attach()
 {
     _smutex.lock();
 
-    _parser->flush();
+    if(_backoff_active())
+    {
+        _smutex.unlock();
+        return SaraN2::FAIL_BACKOFF_ACTIVE;
+    }
+
+    _wake_and_flush();
 
+#if SARAN2_FEATURE_HEALTH
+    uint64_t start = Kernel::get_ms_count();
+#endif
+
+    _command_start(COMMAND_CGATT);
     _parser->send("AT+CGATT=1");
-    if(!_parser->recv("OK"))
+    if(!_command_end(COMMAND_CGATT, _parser->recv("OK")))
     {
+        _check_registration_reject();
         _smutex.unlock();
         return SaraN2::FAIL_TRIGGER_GPRS_ATTACH;
     }
 
+#if SARAN2_FEATURE_HEALTH
+    _health.attaches++;
+    _health.last_attach_ms = Kernel::get_ms_count() - start;
+#endif
+
+#if SARAN2_FEATURE_RATE_CONTROL
+    _rate_stale = true;
+#endif
+
     _smutex.unlock();
 
     return SaraN2::SARAN2_OK;
@@ -1228,10 +1999,11 @@ int SaraN2::gprs_detach()
 {
     _smutex.lock();
 
-    _parser->flush();
+    _wake_and_flush();
 
+    _command_start(COMMAND_CGATT);
     _parser->send("AT+CGATT=0");
-    if(!_parser->recv("OK"))
+    if(!_command_end(COMMAND_CGATT, _parser->recv("OK")))
     {
         _smutex.unlock();
         return SaraN2::FAIL_TRIGGER_GPRS_DETACH;
@@ -1251,15 +2023,27 @@ int SaraN2::auto_register_to_network()
 {
     _smutex.lock();
 
-    _parser->flush();
+    if(_backoff_active())
+    {
+        _smutex.unlock();
+        return SaraN2::FAIL_BACKOFF_ACTIVE;
+    }
+
+    _wake_and_flush();
 
+    _command_start(COMMAND_COPS);
     _parser->send("AT+COPS=0");
-    if(!_parser->recv("OK"))
+    if(!_command_end(COMMAND_COPS, _parser->recv("OK")))
     {
+        _check_registration_reject();
         _smutex.unlock();
         return SaraN2::FAIL_TRIGGER_NETWORK_REGISTER;
     }
 
+#if SARAN2_FEATURE_RATE_CONTROL
+    _rate_stale = true;
+#endif
+
     _smutex.unlock();
 
     return SaraN2::SARAN2_OK;
@@ -1273,10 +2057,11 @@ int SaraN2::deregister_from_network()
 {
     _smutex.lock();
 
-    _parser->flush();
+    _wake_and_flush();
 
+    _command_start(COMMAND_COPS);
     _parser->send("AT+COPS=2");
-    if(!_parser->recv("OK"))
+    if(!_command_end(COMMAND_COPS, _parser->recv("OK")))
     {
         _smutex.unlock();
         return SaraN2::FAIL_TRIGGER_NETWORK_DEREGISTER;
@@ -1287,4 +2072,2932 @@ int SaraN2::deregister_from_network()
     return SaraN2::SARAN2_OK;
 }
 
+#endif /* SARAN2_FEATURE_RADIO */
+
+#if SARAN2_FEATURE_TIME
+
+/** Read network time once with AT+CCLK? and cache it against the
+ *  MCU's monotonic millisecond clock. Call once per wake, all further
+ *  timestamps are extrapolated by get_timestamp() with no AT traffic.
+ *  The cache is also refreshed by +CTZV/+CTZEU NITZ URCs
+ *
+ * @return Indicates success or failure reason
+ */
+int SaraN2::sync_network_time()
+{
+	char line[48];
+
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	uint64_t sent = Kernel::get_ms_count();
+
+	_parser->send("AT+CCLK?");
+	if(!_parser->recv("+CCLK:") || _read_line(line, sizeof(line)) <= 0)
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_GET_NETWORK_TIME;
+	}
+
+	/* The module truncates to whole seconds and the response may have been
+	 * generated at any point during the round trip
+	 */
+	uint32_t round_trip = Kernel::get_ms_count() - sent;
+
+	if(!_update_network_time(line, 1000 + round_trip) || !_parser->recv("OK"))
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_GET_NETWORK_TIME;
+	}
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Enable or disable time zone change reporting (NITZ URCs). When
+ *  enabled, network time updates refresh the cached network time
+ *  whenever the URC is received during any other command
+ *
+ * @param enable True to enable +CTZV reporting, false to disable
+ * @return Indicates success or failure reason
+ */
+int SaraN2::set_time_zone_reporting(bool enable)
+{
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	_parser->send("AT+CTZR=%d", enable ? 1 : 0);
+	if(!_parser->recv("OK"))
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_SET_CTZR;
+	}
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Get the current UTC time extrapolated from the last network time
+ *  sync. This does not communicate with the module
+ *
+ * @param &epoch_ms Address of integer in which to store milliseconds
+ *                  since the Unix epoch
+ * @param &error_ms Address of integer in which to store the estimated
+ *                  worst-case error of epoch_ms in milliseconds
+ * @return Indicates success or failure reason
+ */
+int SaraN2::get_timestamp(uint64_t &epoch_ms, uint32_t &error_ms)
+{
+	uint64_t base_ms;
+	uint64_t ref_ms;
+	uint32_t base_error_ms;
+
+	/* NITZ URCs update the reference from whichever thread holds the
+	 * driver lock, so snapshot it with interrupts off rather than wait
+	 * for the lock, which a CoAP request may hold for seconds
+	 */
+	{
+		CriticalSectionLock lock;
+
+		if(!_time_synchronised)
+		{
+			return SaraN2::TIME_NOT_SYNCHRONISED;
+		}
+
+		base_ms = _time_base_ms;
+		ref_ms = _time_ref_ms;
+		base_error_ms = _time_base_error_ms;
+	}
+
+	uint64_t elapsed = Kernel::get_ms_count() - ref_ms;
+
+	epoch_ms = base_ms + elapsed;
+	error_ms = base_error_ms + (uint32_t)((elapsed * _clock_drift_ppm) / 1000000);
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Get the time zone reported alongside the last network time sync
+ *
+ * @param &quarter_hours Address of integer in which to store the
+ *                       offset from UTC in quarters of an hour
+ * @return Indicates success or failure reason
+ */
+int SaraN2::get_time_zone(int &quarter_hours)
+{
+	CriticalSectionLock lock;
+
+	if(!_time_synchronised)
+	{
+		return SaraN2::TIME_NOT_SYNCHRONISED;
+	}
+
+	quarter_hours = _time_zone;
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Set the tolerance of the MCU clock used to estimate timestamp error
+ *
+ * @param ppm Clock tolerance in parts per million
+ */
+void SaraN2::set_clock_drift_ppm(uint16_t ppm)
+{
+	_clock_drift_ppm = ppm;
+}
+
+#endif /* SARAN2_FEATURE_TIME */
+
+/** Send an AT command that the driver does not wrap, i.e. AT+CGDCONT?,
+ *  while holding the driver lock. Every intermediate response line is
+ *  passed to line_cb until the final result code is received
+ *
+ * @param *command Null-terminated command string, without CR LF
+ * @param line_cb Optional callback receiving a pointer to and length of
+ *                each response line. The pointer refers to the driver's
+ *                line buffer and is only valid for the duration of the call
+ * @param timeout_ms Maximum time to wait for each response line
+ * @return SARAN2_OK on "OK", RAW_COMMAND_ERROR on "ERROR" or 
+ *         "+CME ERROR", FAIL_RAW_COMMAND on timeout
+ */
+int SaraN2::raw_command(const char *command, Callback<void(const char *, int)> line_cb, 
+                        uint32_t timeout_ms)
+{
+	int status = SaraN2::FAIL_RAW_COMMAND;
+
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	_parser->set_timeout(timeout_ms);
+
+	_parser->send("%s", command);
+
+	while(true)
+	{
+		int length = _read_line(_line_buffer, sizeof(_line_buffer));
+
+		if(length < 0)
+		{
+			break;
+		}
+
+		if(length == 0)
+		{
+			continue;
+		}
+
+		if(strcmp(_line_buffer, "OK") == 0)
+		{
+			status = SaraN2::SARAN2_OK;
+			break;
+		}
+
+		if(strcmp(_line_buffer, "ERROR") == 0 || strncmp(_line_buffer, "+CME ERROR", 10) == 0)
+		{
+			status = SaraN2::RAW_COMMAND_ERROR;
+			break;
+		}
+
+		if(line_cb)
+		{
+			line_cb(_line_buffer, length);
+		}
+	}
+
+	_parser->set_timeout(_at_timeout_ms);
+
+	_smutex.unlock();
+
+	return status;
+}
+
+#if SARAN2_FEATURE_FOTA
+
+/** Stream a firmware delta package into the module with AT+NFWUPD. The 
+ *  package is read in SARAN2_FOTA_SEGMENT_SIZE chunks through read_cb, 
+ *  i.e. from MCU flash, and each hex-encoded segment is checksummed and 
+ *  retried until the module accepts it. When all segments have been 
+ *  delivered the package is validated by the module
+ *
+ * @param size Total size of the package in bytes
+ * @param read_cb Callback that copies length bytes of the package, starting
+ *                at offset, into the supplied buffer. Must return 0 on success
+ * @param &next_segment Address of integer holding the segment number to start
+ *                      from. Pass 0 to erase any previous package and start
+ *                      afresh. On return it holds the next segment to send, 
+ *                      so a failed transfer can be resumed
+ * @param *stats Optional pointer to a FirmwareUpdateStats_t in which to store
+ *               transfer statistics
+ * @return Indicates success or failure reason
+ */
+int SaraN2::download_firmware_package(uint32_t size, Callback<int(uint32_t, uint8_t *, uint32_t)> read_cb,
+                                      uint16_t &next_segment, FirmwareUpdateStats_t *stats)
+{
+	/* The line buffer is not used while segments are being sent, so it
+	 * doubles as the segment buffer to keep this off the caller's stack
+	 */
+	static_assert(SARAN2_FOTA_SEGMENT_SIZE <= SARAN2_LINE_BUFFER_SIZE, "FOTA segment must fit in the line buffer");
+
+	uint8_t *segment = (uint8_t *)_line_buffer;
+	uint16_t segments = 0;
+	uint16_t retries = 0;
+	uint32_t bytes = 0;
+	int status = SaraN2::SARAN2_OK;
+
+	uint64_t start = Kernel::get_ms_count();
+
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	if(next_segment == 0)
+	{
+		/* Erasing the package area can take several seconds */
+		_parser->set_timeout(10000);
+		_parser->send("AT+NFWUPD=0");
+		if(!_parser->recv("OK"))
+		{
+			_parser->set_timeout(_at_timeout_ms);
+			_smutex.unlock();
+			return SaraN2::FAIL_FOTA_ERASE;
+		}
+		_parser->set_timeout(_at_timeout_ms);
+	}
+
+	uint32_t offset = (uint32_t)next_segment * SARAN2_FOTA_SEGMENT_SIZE;
+
+	while(offset < size)
+	{
+		uint16_t length = (size - offset > SARAN2_FOTA_SEGMENT_SIZE) ? SARAN2_FOTA_SEGMENT_SIZE : size - offset;
+
+		if(read_cb(offset, segment, length) != 0)
+		{
+			status = SaraN2::FAIL_FOTA_READ;
+			break;
+		}
+
+		int attempt = 0;
+		while(!_send_firmware_segment(next_segment, segment, length))
+		{
+			if(++attempt >= SARAN2_FOTA_SEGMENT_RETRIES)
+			{
+				status = SaraN2::FAIL_FOTA_SEGMENT;
+				break;
+			}
+			retries++;
+#if SARAN2_FEATURE_HEALTH
+			_health.retries++;
+#endif
+		}
+
+		if(status != SaraN2::SARAN2_OK)
+		{
+			break;
+		}
+
+		offset += length;
+		bytes += length;
+		segments++;
+		next_segment++;
+	}
+
+	if(status == SaraN2::SARAN2_OK)
+	{
+		_parser->set_timeout(10000);
+		_parser->send("AT+NFWUPD=2");
+		if(!_parser->recv("OK"))
+		{
+			status = SaraN2::FAIL_FOTA_VALIDATE;
+		}
+		_parser->set_timeout(_at_timeout_ms);
+	}
+
+	_smutex.unlock();
+
+	if(stats != NULL)
+	{
+		stats->bytes = bytes;
+		stats->segments = segments;
+		stats->retries = retries;
+		stats->elapsed_ms = Kernel::get_ms_count() - start;
+		stats->bytes_per_sec = stats->elapsed_ms ? (uint32_t)(((uint64_t)bytes * 1000) / stats->elapsed_ms) : 0;
+	}
+
+	return status;
+}
+
+/** Apply a previously downloaded and validated firmware package. The 
+ *  module reboots to install the update, and this function blocks until 
+ *  it responds to "AT" again
+ *
+ * @param &downtime_ms Address of integer in which to store the time for 
+ *                     which the module was unavailable
+ * @return Indicates success or failure reason
+ */
+int SaraN2::apply_firmware_package(uint32_t &downtime_ms)
+{
+	int status = SaraN2::FAIL_FOTA_APPLY;
+
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	uint64_t start = Kernel::get_ms_count();
+
+	_parser->send("AT+NFWUPD=5");
+	if(!_parser->recv("OK"))
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_FOTA_APPLY;
+	}
+
+	_parser->set_timeout(1000);
+
+	while(Kernel::get_ms_count() - start < SARAN2_FOTA_APPLY_TIMEOUT_MS)
+	{
+		_parser->flush();
+		_parser->send("AT");
+		if(_parser->recv("OK"))
+		{
+			status = SaraN2::SARAN2_OK;
+			break;
+		}
+	}
+
+	downtime_ms = Kernel::get_ms_count() - start;
+
+	_parser->set_timeout(_at_timeout_ms);
+
+	_smutex.unlock();
+
+	return status;
+}
+
+#endif /* SARAN2_FEATURE_FOTA */
+
+/** Encode binary data as lower-case hex, as used for payloads on the
+ *  AT interface. No terminator is written
+ *
+ * @param *data Pointer to the data to encode
+ * @param length Number of bytes to encode
+ * @param *hex Pointer to a byte array of at least 2 * length bytes
+ * @return Number of characters written
+ */
+size_t SaraN2::hex_encode(const uint8_t *data, size_t length, char *hex)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	size_t i = 0;
+
+#if SARAN2_HEX_SWAR && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for(; i + 4 <= length; i += 4)
+	{
+		uint32_t word;
+		memcpy(&word, &data[i], sizeof(word));
+
+		/* Split into high and low nibbles, one per byte lane, then map 0-9 to 
+		 * '0'-'9' and 10-15 to 'a'-'f' without any carry between lanes
+		 */
+		uint32_t high = (word >> 4) & 0x0F0F0F0FUL;
+		uint32_t low = word & 0x0F0F0F0FUL;
+
+		high += 0x30303030UL + (((high + 0x06060606UL) >> 4) & 0x01010101UL) * 39;
+		low += 0x30303030UL + (((low + 0x06060606UL) >> 4) & 0x01010101UL) * 39;
+
+		/* Interleave so that each byte's high nibble precedes its low nibble */
+		uint32_t high_lo = ((high & 0xFFFF) | ((high & 0xFFFF) << 8)) & 0x00FF00FFUL;
+		uint32_t high_hi = ((high >> 16) | ((high >> 16) << 8)) & 0x00FF00FFUL;
+		uint32_t low_lo = ((low & 0xFFFF) | ((low & 0xFFFF) << 8)) & 0x00FF00FFUL;
+		uint32_t low_hi = ((low >> 16) | ((low >> 16) << 8)) & 0x00FF00FFUL;
+
+		uint32_t out[2] = { high_lo | (low_lo << 8), high_hi | (low_hi << 8) };
+		memcpy(&hex[2 * i], out, sizeof(out));
+	}
+#endif
+
+	for(; i < length; i++)
+	{
+		hex[2 * i]     = digits[data[i] >> 4];
+		hex[2 * i + 1] = digits[data[i] & 0x0F];
+	}
+
+	return 2 * length;
+}
+
+/** Decode upper- or lower-case hex, i.e. a payload received into 
+ *  recv_data, into binary data
+ *
+ * @param *hex Pointer to the characters to decode
+ * @param length Number of characters to decode, must be even
+ * @param *data Pointer to a byte array of at least length / 2 bytes
+ * @return Number of bytes written, or -1 if the input is not valid hex
+ */
+int SaraN2::hex_decode(const char *hex, size_t length, uint8_t *data)
+{
+	if(length % 2 != 0)
+	{
+		return -1;
+	}
+
+	size_t i = 0;
+
+#if SARAN2_HEX_SWAR && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for(; i + 8 <= length; i += 8)
+	{
+		uint32_t words[2];
+		memcpy(words, &hex[i], sizeof(words));
+
+		if((words[0] | words[1]) & 0x80808080UL)
+		{
+			return -1;
+		}
+
+		for(int w = 0; w < 2; w++)
+		{
+			/* Folding bit 5 in maps 'A'-'F' onto 'a'-'f' and leaves digits alone.
+			 * With every lane below 0x80, adding (0x80 - lower bound) sets a 
+			 * lane's top bit iff it is >= the bound, likewise for upper bounds
+			 */
+			uint32_t raw = words[w];
+			uint32_t x = raw | 0x20202020UL;
+
+			uint32_t digit = (raw + 0x50505050UL) & ~(raw + 0x46464646UL);
+			uint32_t alpha = (x + 0x1F1F1F1FUL) & ~(x + 0x19191919UL);
+
+			if(((digit | alpha) & 0x80808080UL) != 0x80808080UL)
+			{
+				return -1;
+			}
+
+			uint32_t nibbles = (x & 0x0F0F0F0FUL) + ((x >> 6) & 0x01010101UL) * 9;
+			uint32_t pairs = ((nibbles << 4) | (nibbles >> 8)) & 0x00FF00FFUL;
+
+			data[i / 2 + 2 * w]     = pairs & 0xFF;
+			data[i / 2 + 2 * w + 1] = (pairs >> 16) & 0xFF;
+		}
+	}
+#endif
+
+	for(; i < length; i += 2)
+	{
+		uint8_t byte = 0;
+
+		for(int j = 0; j < 2; j++)
+		{
+			char c = hex[i + j];
+			uint8_t nibble;
+
+			if(c >= '0' && c <= '9')
+			{
+				nibble = c - '0';
+			}
+			else if((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+			{
+				nibble = (c | 0x20) - 'a' + 10;
+			}
+			else
+			{
+				return -1;
+			}
+
+			byte = (byte << 4) | nibble;
+		}
+
+		data[i / 2] = byte;
+	}
+
+	return length / 2;
+}
+
+/** Report how much of the calling thread's stack has never been used.
+ *  Requires the RTOS stack watermark to be enabled, i.e. by setting
+ *  MBED_STACK_STATS_ENABLED, otherwise 0 is reported
+ *
+ * @param &free_bytes Address of integer in which to store the number 
+ *                    of stack bytes that have never been used
+ * @return Indicates success or failure reason
+ */
+int SaraN2::get_stack_headroom(uint32_t &free_bytes)
+{
+	osThreadId_t thread = ThisThread::get_id();
+	if(thread == NULL)
+	{
+		return SaraN2::FAIL_GET_STACK_HEADROOM;
+	}
+
+	free_bytes = osThreadGetStackSpace(thread);
+
+	return SaraN2::SARAN2_OK;
+}
+
+#if SARAN2_FEATURE_HEALTH
+
+/** Copy the current driver health counters
+ *
+ * @param &health Address of Health_t in which to store the counters
+ */
+void SaraN2::get_health(Health_t &health)
+{
+	_smutex.lock();
+
+	health = _health;
+
+	_smutex.unlock();
+}
+
+/** Clear all driver health counters
+ */
+void SaraN2::reset_health()
+{
+	_smutex.lock();
+
+	memset(&_health, 0, sizeof(_health));
+
+	_smutex.unlock();
+}
+
+/** Encode the driver health counters into a compact binary record. The
+ *  record is a version byte, the Health_t counters and the p50, p90 and
+ *  p99 CoAP latency in milliseconds as unsigned LEB128 varints, followed
+ *  by a trailer of the record length and SARAN2_HEALTH_MAGIC
+ *
+ * @param *buffer Pointer to a byte array in which to store the record
+ * @param size Size of buffer, SARAN2_HEALTH_RECORD_SIZE is always enough
+ * @param &length Address of integer in which to store the record length
+ * @return Indicates success or failure reason
+ */
+int SaraN2::encode_health_record(uint8_t *buffer, size_t size, size_t &length)
+{
+	if(size < SARAN2_HEALTH_RECORD_SIZE)
+	{
+		return SaraN2::HEALTH_BUFFER_TOO_SMALL;
+	}
+
+	_smutex.lock();
+
+	size_t n = 0;
+
+	buffer[n++] = SARAN2_HEALTH_VERSION;
+	n += _put_varint(&buffer[n], _health.coap_requests);
+	n += _put_varint(&buffer[n], _health.coap_failures);
+	n += _put_varint(&buffer[n], _health.timeouts);
+	n += _put_varint(&buffer[n], _health.retries);
+	n += _put_varint(&buffer[n], _health.reboots);
+	n += _put_varint(&buffer[n], _health.attaches);
+	n += _put_varint(&buffer[n], _health.last_attach_ms);
+	n += _put_varint(&buffer[n], _health.psm_wakes);
+	n += _put_varint(&buffer[n], _histogram_quantile(_health.coap_latency, 50));
+	n += _put_varint(&buffer[n], _histogram_quantile(_health.coap_latency, 90));
+	n += _put_varint(&buffer[n], _histogram_quantile(_health.coap_latency, 99));
+
+	_smutex.unlock();
+
+	/* Trailer lets the server find the record at the end of a payload */
+	buffer[n] = n;
+	n++;
+	buffer[n++] = SARAN2_HEALTH_MAGIC;
+
+	length = n;
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Append the health record to the payload of coap_post at most once 
+ *  per interval. The server recognises the record by the trailing 
+ *  SARAN2_HEALTH_MAGIC byte and the length byte that precedes it. Only
+ *  APPLICATION_OCTET payloads carry the record, and only when it still
+ *  fits within SARAN2_MAX_COAP_PAYLOAD, otherwise it waits for a later post
+ *
+ * @param interval_s Minimum interval between piggybacked records in 
+ *                   seconds, 0 disables piggybacking (the default)
+ */
+void SaraN2::set_health_piggyback(uint32_t interval_s)
+{
+	_smutex.lock();
+
+	_health_interval_s = interval_s;
+	_health_last_sent_ms = 0;
+
+	_smutex.unlock();
+}
+
+/** Append a value to a buffer as an unsigned LEB128 varint
+ *
+ * @param *buffer Pointer to the byte array to write to
+ * @param value Value to encode
+ * @return Number of bytes written, at most 5
+ */
+size_t SaraN2::_put_varint(uint8_t *buffer, uint32_t value)
+{
+	size_t n = 0;
+
+	while(value >= 0x80)
+	{
+		buffer[n++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+
+	buffer[n++] = value;
+
+	return n;
+}
+
+#endif /* SARAN2_FEATURE_HEALTH */
+
+#if SARAN2_FEATURE_OPERATOR_PROFILES
+
+/** Add a profile to the operator profile table, replacing any profile
+ *  with the same MCC and MNC. Takes effect at the next call to 
+ *  apply_operator_profile()
+ *
+ * @param &profile Profile to add
+ * @return Indicates success or failure reason
+ */
+int SaraN2::set_operator_profile(const OperatorProfile_t &profile)
+{
+	_smutex.lock();
+
+	for(uint8_t i = 0; i < _operator_profile_count; i++)
+	{
+		if(_operator_profiles[i].mcc == profile.mcc && _operator_profiles[i].mnc == profile.mnc)
+		{
+			_operator_profiles[i] = profile;
+
+			_smutex.unlock();
+			return SaraN2::SARAN2_OK;
+		}
+	}
+
+	if(_operator_profile_count >= SARAN2_OPERATOR_PROFILES)
+	{
+		_smutex.unlock();
+		return SaraN2::OPERATOR_TABLE_FULL;
+	}
+
+	_operator_profiles[_operator_profile_count++] = profile;
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Remove every profile from the operator profile table
+ */
+void SaraN2::clear_operator_profiles()
+{
+	_smutex.lock();
+
+	_operator_profile_count = 0;
+
+	_smutex.unlock();
+}
+
+/** Read the MCC and MNC of the serving network with AT+COPS?
+ *
+ * @param &mcc Address of integer in which to store the MCC
+ * @param &mnc Address of integer in which to store the MNC
+ * @return Indicates success or failure reason
+ */
+int SaraN2::get_serving_plmn(uint16_t &mcc, uint16_t &mnc)
+{
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	if(!_read_serving_plmn(mcc, mnc))
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_GET_PLMN;
+	}
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Select the profile of the serving network and apply its timeouts
+ *  and, if it requests PSM, its T3412 and T3324 timers. Networks 
+ *  without a profile use the MCC 0 profile or the built-in defaults
+ *
+ * @return Indicates success or failure reason
+ */
+int SaraN2::apply_operator_profile()
+{
+	uint16_t mcc;
+	uint16_t mnc;
+
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	if(!_read_serving_plmn(mcc, mnc))
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_GET_PLMN;
+	}
+
+	const OperatorProfile_t *selected = NULL;
+
+	for(uint8_t i = 0; i < _operator_profile_count; i++)
+	{
+		const OperatorProfile_t &profile = _operator_profiles[i];
+
+		if(profile.mcc == mcc && profile.mnc == mnc)
+		{
+			selected = &profile;
+			break;
+		}
+
+		if(profile.mcc == 0 && selected == NULL)
+		{
+			selected = &profile;
+		}
+	}
+
+	if(selected != NULL)
+	{
+		_operator_profile = *selected;
+	}
+	else
+	{
+		/* Nothing of the previous operator's profile carries over */
+		const OperatorProfile_t defaults = SARAN2_DEFAULT_OPERATOR_PROFILE;
+
+		_operator_profile = defaults;
+	}
+
+	_operator_profile.mcc = mcc;
+	_operator_profile.mnc = mnc;
+
+	_at_timeout_ms = _operator_profile.at_timeout_ms;
+	_coap_timeout_ms = _operator_profile.coap_timeout_ms;
+	_parser->set_timeout(_at_timeout_ms);
+
+#if SARAN2_FEATURE_PSM
+	if(_operator_profile.request_psm &&
+	   (_requested_psm != 1 || strncmp(_requested_t3412, _operator_profile.t3412, 8) != 0 ||
+	    strncmp(_requested_t3324, _operator_profile.t3324, 8) != 0))
+	{
+		_parser->send("AT+CPSMS=1,,,\"%s\",\"%s\"", _operator_profile.t3412, _operator_profile.t3324);
+		if(!_parser->recv("OK"))
+		{
+			_smutex.unlock();
+			return SaraN2::FAIL_APPLY_OPERATOR_PROFILE;
+		}
+
+		strncpy(_requested_t3412, _operator_profile.t3412, 8);
+		strncpy(_requested_t3324, _operator_profile.t3324, 8);
+		_requested_psm = 1;
+	}
+#endif
+
+	_operator_profile_applied = true;
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Apply the operator profile automatically whenever cereg() reports
+ *  a new registration, home or roaming
+ *
+ * @param enable True to apply profiles automatically
+ */
+void SaraN2::set_operator_profile_auto(bool enable)
+{
+	_smutex.lock();
+
+	_operator_profile_auto = enable;
+	_operator_profile_applied = false;
+
+	_smutex.unlock();
+}
+
+/** Copy the profile currently in effect, i.e. to read its preferred
+ *  block size and transport
+ *
+ * @param &profile Address of OperatorProfile_t in which to store it
+ */
+void SaraN2::get_operator_profile(OperatorProfile_t &profile)
+{
+	_smutex.lock();
+
+	profile = _operator_profile;
+
+	_smutex.unlock();
+}
+
+/** Read the MCC and MNC of the serving network. Must be called with
+ *  the driver lock held
+ *
+ * @param &mcc Address of integer in which to store the MCC
+ * @param &mnc Address of integer in which to store the MNC
+ * @return True if the module is registered and the PLMN was read
+ */
+bool SaraN2::_read_serving_plmn(uint16_t &mcc, uint16_t &mnc)
+{
+	int format;
+	const char *oper;
+	int oper_length;
+
+	/* Unregistered, the reply is +COPS: <mode> alone */
+	if(!_read_operator(format, oper, oper_length) || format < 0)
+	{
+		return false;
+	}
+
+	if(format != 2)
+	{
+		/* Switch to the numeric format for one read only, so that later
+		 * AT+COPS? replies, i.e. through raw_command(), are unchanged
+		 */
+		int numeric = -1;
+
+		_parser->send("AT+COPS=3,2");
+		bool ok = _parser->recv("OK") && _read_operator(numeric, oper, oper_length) && numeric == 2;
+
+		_parser->send("AT+COPS=3,%d", format);
+		_parser->recv("OK");
+
+		if(!ok)
+		{
+			return false;
+		}
+	}
+
+	/* The numeric <oper> is "MCCMNC", where the MNC has two or three digits */
+	if(oper_length != 5 && oper_length != 6)
+	{
+		return false;
+	}
+
+	mcc = (oper[0] - '0') * 100 + (oper[1] - '0') * 10 + (oper[2] - '0');
+	mnc = strtol(&oper[3], NULL, 10);
+
+	return true;
+}
+
+/** Read the operator reported by AT+COPS?, always consuming the 
+ *  final OK. Must be called with the driver lock held
+ *
+ * @param &format Address of integer in which to store the <format>
+ *                of the reply, -1 if the module is not registered
+ * @param &oper Address of pointer in which to store <oper>, within 
+ *              the line buffer
+ * @param &oper_length Address of integer in which to store its length
+ * @return True if the reply and its OK were read
+ */
+bool SaraN2::_read_operator(int &format, const char *&oper, int &oper_length)
+{
+	/* +COPS: <mode>[,<format>,<oper>] */
+	const char *fields[3];
+	int lengths[3];
+	int count = 0;
+
+	format = -1;
+	oper = _line_buffer;
+	oper_length = 0;
+
+	_parser->send("AT+COPS?");
+	if(!_parser->recv("+COPS: "))
+	{
+		return false;
+	}
+
+	int length = _read_line(_line_buffer, sizeof(_line_buffer));
+	if(length > 0)
+	{
+		count = _split_fields(_line_buffer, length, fields, lengths, 3);
+	}
+
+	if(count >= 3)
+	{
+		format = strtol(fields[1], NULL, 10);
+		oper = fields[2];
+		oper_length = lengths[2];
+	}
+
+	return _parser->recv("OK");
+}
+
+#endif /* SARAN2_FEATURE_OPERATOR_PROFILES */
+
+#if SARAN2_FEATURE_ADAPTIVE_TIMEOUT
+
+/** Read the timeout currently used for a command
+ *
+ * @param command Enumerated COMMAND_x value
+ * @param &timeout_ms Address of integer in which to store the timeout
+ * @return Indicates success or failure reason
+ */
+int SaraN2::get_command_timeout(uint8_t command, uint32_t &timeout_ms)
+{
+	if(command >= COMMAND_COUNT)
+	{
+		return SaraN2::INVALID_COMMAND;
+	}
+
+	_smutex.lock();
+
+	timeout_ms = _command_timeout(command);
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Forget all observed command latencies and return every command to
+ *  its seed timeout
+ */
+void SaraN2::reset_command_timeouts()
+{
+	_smutex.lock();
+
+	memset(_command_latency, 0, sizeof(_command_latency));
+
+	_smutex.unlock();
+}
+
+#endif /* SARAN2_FEATURE_ADAPTIVE_TIMEOUT */
+
+#if SARAN2_FEATURE_WARM_STATE
+
+/** Read the module IMEI with AT+CGSN=1
+ *
+ * @param *imei Pointer to Char array of at least 16 bytes in which to
+ *              store the IMEI
+ * @return Indicates success or failure reason
+ */
+int SaraN2::get_imei(char *imei)
+{
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	if(!_read_imei())
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_GET_IMEI;
+	}
+
+	memcpy(imei, _imei, sizeof(_imei));
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Capture the cached module state, i.e. before a planned reset or
+ *  periodically into retained RAM
+ *
+ * @param &state Address of WarmState_t in which to store the state
+ * @return Indicates success or failure reason
+ */
+int SaraN2::save_warm_state(WarmState_t &state)
+{
+	_smutex.lock();
+
+	if(_imei[0] == '\0')
+	{
+		_wake_and_flush();
+
+		if(!_read_imei())
+		{
+			_smutex.unlock();
+			return SaraN2::FAIL_GET_IMEI;
+		}
+	}
+
+	/* Zero first so that padding bytes are covered by the stamp */
+	memset(&state, 0, sizeof(state));
+
+	state.magic = SARAN2_WARM_MAGIC;
+	state.version = SARAN2_WARM_VERSION;
+	state.length = sizeof(state);
+	memcpy(state.imei, _imei, sizeof(state.imei));
+	state.coap_profile = -1;
+	state.coap_socket = -1;
+
+	/* Read fresh rather than cached, as restore_warm_state() relies on 
+	 * these to tell whether the module has rebooted
+	 */
+	int registration_status = UNKNOWN;
+	uint32_t cell_id = 0xFFFFFFFF;
+
+	_wake_and_flush();
+	_read_registration(registration_status, cell_id);
+
+	state.registration_status = registration_status;
+	state.cell_id = cell_id;
+
+#if SARAN2_FEATURE_COAP_PROFILES
+	state.coap_profile = _coap_profile;
+#endif
+
+#if SARAN2_FEATURE_COAP_METHODS
+	state.coap_socket = _coap_socket;
+#endif
+
+#if SARAN2_FEATURE_NCONFIG
+	state.nconfig_mask = _nconfig_mask;
+	state.nconfig_values = _nconfig_values;
+#endif
+
+#if SARAN2_FEATURE_PSM
+	state.requested_psm = _requested_psm;
+	memcpy(state.t3412, _requested_t3412, sizeof(state.t3412));
+	memcpy(state.t3324, _requested_t3324, sizeof(state.t3324));
+#endif
+
+#if SARAN2_FEATURE_OPERATOR_PROFILES
+	state.operator_profile = _operator_profile;
+#endif
+
+	_smutex.unlock();
+
+	state.stamp = _crc32((const uint8_t *)&state, offsetof(WarmState_t, stamp));
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Adopt state saved by save_warm_state() if its stamp is valid,
+ *  the module is the one it was saved from, checked with AT+CGSN=1,
+ *  and it has not rebooted since, checked by a +CEREG report still
+ *  showing the registration and cell that were saved. State saved
+ *  while unregistered cannot be checked and is never adopted
+ *
+ * @param &state Saved state
+ * @return SARAN2_OK if the state was adopted, WARM_STATE_INVALID, 
+ *         WARM_STATE_MISMATCH or FAIL_GET_IMEI
+ */
+int SaraN2::restore_warm_state(const WarmState_t &state)
+{
+	if(state.magic != SARAN2_WARM_MAGIC || state.version != SARAN2_WARM_VERSION ||
+	   state.length != sizeof(state) ||
+	   state.stamp != _crc32((const uint8_t *)&state, offsetof(WarmState_t, stamp)))
+	{
+		return SaraN2::WARM_STATE_INVALID;
+	}
+
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	if(!_read_imei())
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_GET_IMEI;
+	}
+
+	if(strncmp(_imei, state.imei, sizeof(_imei)) != 0)
+	{
+		_smutex.unlock();
+		return SaraN2::WARM_STATE_MISMATCH;
+	}
+
+	/* The IMEI survives a module reboot, the registration does not. A 
+	 * module that rebooted with the MCU is unregistered or, having 
+	 * re-registered, on a new cell or at least reports it afresh
+	 */
+	int registration_status;
+	uint32_t cell_id;
+
+	bool registered = state.registration_status == SaraN2::REGISTERED_HOME_NETWORK ||
+	                  state.registration_status == SaraN2::REGISTERED_ROAMING;
+
+	if(!registered || !_read_registration(registration_status, cell_id) ||
+	   registration_status != state.registration_status || cell_id != state.cell_id)
+	{
+		_smutex.unlock();
+		return SaraN2::WARM_STATE_MISMATCH;
+	}
+
+#if SARAN2_FEATURE_COAP_PROFILES
+	_coap_profile = state.coap_profile;
+#endif
+
+#if SARAN2_FEATURE_COAP_METHODS
+	/* The module kept running, so the socket is still open and bound */
+	_coap_socket = state.coap_socket;
+#endif
+
+#if SARAN2_FEATURE_NCONFIG
+	_nconfig_mask = state.nconfig_mask;
+	_nconfig_values = state.nconfig_values;
+#endif
+
+#if SARAN2_FEATURE_PSM
+	_requested_psm = state.requested_psm;
+	memcpy(_requested_t3412, state.t3412, sizeof(_requested_t3412));
+	memcpy(_requested_t3324, state.t3324, sizeof(_requested_t3324));
+	_registration_status = registration_status;
+	_last_cell_id = cell_id;
+#endif
+
+#if SARAN2_FEATURE_OPERATOR_PROFILES
+	_operator_profile = state.operator_profile;
+	_at_timeout_ms = _operator_profile.at_timeout_ms;
+	_coap_timeout_ms = _operator_profile.coap_timeout_ms;
+	_parser->set_timeout(_at_timeout_ms);
+	_operator_profile_applied = true;
+#endif
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Read the IMEI into the cache. Must be called with the driver lock 
+ *  held
+ *
+ * @return True if the IMEI was read
+ */
+bool SaraN2::_read_imei()
+{
+	char imei[16];
+
+	_parser->send("AT+CGSN=1");
+	if(!_parser->recv("+CGSN: %15s", imei) || !_parser->recv("OK"))
+	{
+		return false;
+	}
+
+	memcpy(_imei, imei, sizeof(_imei));
+
+	return true;
+}
+
+/** Read the registration status and serving cell with a +CEREG 
+ *  level 2 report, restoring level 0 afterwards. Must be called 
+ *  with the driver lock held
+ *
+ * @param &status Address of integer in which to store the status
+ * @param &cell_id Address of integer in which to store the cell ID,
+ *                 0xFFFFFFFF if none was reported
+ * @return True if the report was read
+ */
+bool SaraN2::_read_registration(int &status, uint32_t &cell_id)
+{
+	_parser->send("AT+CEREG=2");
+	if(!_parser->recv("OK"))
+	{
+		return false;
+	}
+
+	/* +CEREG: <n>,<stat>[,[<tac>],[<ci>],[<AcT>]] */
+	const char *fields[5];
+	int lengths[5];
+	int count = 0;
+
+	_parser->send("AT+CEREG?");
+	if(_parser->recv("+CEREG: "))
+	{
+		int length = _read_line(_line_buffer, sizeof(_line_buffer));
+		if(length > 0)
+		{
+			count = _split_fields(_line_buffer, length, fields, lengths, 5);
+		}
+	}
+
+	bool ok = count >= 2 && _parser->recv("OK");
+
+	if(ok)
+	{
+		status = strtol(fields[1], NULL, 10);
+		cell_id = (count > 3 && lengths[3] > 0) ? strtoul(fields[3], NULL, 16) : 0xFFFFFFFF;
+	}
+
+	_parser->send("AT+CEREG=0");
+	_parser->recv("OK");
+
+	return ok;
+}
+
+/** CRC-32 (IEEE 802.3) of a block of memory
+ *
+ * @param *data Pointer to the data
+ * @param length Number of bytes
+ * @return CRC-32
+ */
+uint32_t SaraN2::_crc32(const uint8_t *data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	for(size_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+
+		for(int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320UL & -(crc & 1));
+		}
+	}
+
+	return ~crc;
+}
+
+#endif /* SARAN2_FEATURE_WARM_STATE */
+
+#if SARAN2_FEATURE_WAKE
+
+/** Set how long the module may be left without commands before it
+ *  is treated as possibly asleep. VINT going low always counts
+ *
+ * @param idle_ms Idle time in milliseconds, 0 to rely on VINT only
+ */
+void SaraN2::set_wake_idle_time(uint32_t idle_ms)
+{
+	_smutex.lock();
+
+	_wake_idle_ms = idle_ms;
+
+	_smutex.unlock();
+}
+
+/** Copy the wake-up handshake statistics
+ *
+ * @param &stats Address of WakeStats_t in which to store them
+ */
+void SaraN2::get_wake_stats(WakeStats_t &stats)
+{
+	_smutex.lock();
+
+	stats = _wake_stats;
+
+	_smutex.unlock();
+}
+
+#endif /* SARAN2_FEATURE_WAKE */
+
+#if SARAN2_FEATURE_RATE_CONTROL
+
+/** Read the APN rate control of the default PDP context with 
+ *  AT+CGAPNRC and resize the uplink token bucket to match. Called
+ *  automatically before the first CoAP request after an attach
+ *
+ * @return Indicates success or failure reason
+ */
+int SaraN2::read_apn_rate_control()
+{
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	if(!_read_apn_rate_control())
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_GET_RATE_CONTROL;
+	}
+
+	_rate_stale = false;
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Report the current uplink allowance
+ *
+ * @param &allowance Address of UplinkAllowance_t in which to store it
+ */
+void SaraN2::get_uplink_allowance(UplinkAllowance_t &allowance)
+{
+	_smutex.lock();
+
+	allowance.max_rate = _rate_max;
+	allowance.unit_ms = _rate_unit_ms;
+	allowance.deferred = _rate_deferred;
+	allowance.exception_reports = _rate_exception_reports;
+
+	if(_rate_max == 0)
+	{
+		allowance.available = 0xFFFFFFFF;
+		allowance.next_ms = 0;
+	}
+	else
+	{
+		_refill_uplink_tokens();
+
+		allowance.available = _rate_credit / _rate_unit_ms;
+		allowance.next_ms = (allowance.available > 0) ? 0 : 
+		                    (_rate_unit_ms - _rate_credit + _rate_max - 1) / _rate_max;
+	}
+
+	_smutex.unlock();
+}
+
+/** Enable or disable uplink pacing. While enabled, CoAP requests 
+ *  beyond the APN rate control return UPLINK_RATE_LIMITED without 
+ *  being sent, so the application can coalesce or defer them
+ *
+ * @param enable True to pace uplinks, the default
+ */
+void SaraN2::set_uplink_pacing(bool enable)
+{
+	_smutex.lock();
+
+	_rate_pacing = enable;
+
+	_smutex.unlock();
+}
+
+/** Read AT+CGAPNRC into the token bucket. Must be called with the 
+ *  driver lock held
+ *
+ * @return True if the rate control was read
+ */
+bool SaraN2::_read_apn_rate_control()
+{
+	/* Uplink time units of 3GPP TS 27.007 */
+	static const uint32_t unit_ms[] = { 0, 60000, 3600000, 86400000, 604800000 };
+
+	/* +CGAPNRC: <cid>[,<additional_exception_reports>[,<uplink_time_unit>
+	 * [,<maximum_uplink_rate>]]], where a missing rate means unrestricted
+	 */
+	const char *fields[4];
+	int lengths[4];
+	int count = 0;
+
+	_parser->send("AT+CGAPNRC");
+	if(_parser->recv("+CGAPNRC: "))
+	{
+		int length = _read_line(_line_buffer, sizeof(_line_buffer));
+		if(length > 0)
+		{
+			count = _split_fields(_line_buffer, length, fields, lengths, 4);
+		}
+	}
+
+	if(count < 1 || !_parser->recv("OK"))
+	{
+		return false;
+	}
+
+	uint32_t unit = (count >= 3) ? strtoul(fields[2], NULL, 10) : 0;
+	uint32_t rate = (count >= 4) ? strtoul(fields[3], NULL, 10) : 0;
+
+	if(unit == 0 || unit >= sizeof(unit_ms) / sizeof(unit_ms[0]))
+	{
+		rate = 0;
+	}
+
+	_rate_exception_reports = (count >= 2) && fields[1][0] == '1';
+
+	if(rate != _rate_max || (rate != 0 && unit_ms[unit] != _rate_unit_ms))
+	{
+		/* A new allowance starts full, as the network's own window is 
+		 * not visible to the driver
+		 */
+		_rate_max = rate;
+		_rate_unit_ms = (rate != 0) ? unit_ms[unit] : 0;
+		_rate_credit = (uint64_t)_rate_max * _rate_unit_ms;
+		_rate_refill_ms = Kernel::get_ms_count();
+	}
+
+	return true;
+}
+
+/** Refill the token bucket for the time elapsed since the last refill.
+ *  Credit is kept in uplink-milliseconds so that one uplink costs
+ *  _rate_unit_ms and max_rate uplinks are earned per _rate_unit_ms
+ */
+void SaraN2::_refill_uplink_tokens()
+{
+	uint64_t now = Kernel::get_ms_count();
+	uint64_t capacity = (uint64_t)_rate_max * _rate_unit_ms;
+
+	_rate_credit += (now - _rate_refill_ms) * _rate_max;
+	_rate_refill_ms = now;
+
+	if(_rate_credit > capacity)
+	{
+		_rate_credit = capacity;
+	}
+}
+
+#endif /* SARAN2_FEATURE_RATE_CONTROL */
+
+#if SARAN2_FEATURE_BACKOFF
+
+/** Report the back-off in force after a registration reject. While
+ *  it lasts, auto_register_to_network(), gprs_attach() and CoAP
+ *  requests return FAIL_BACKOFF_ACTIVE without reaching the network
+ *
+ * @param &remaining_ms Address of integer in which to store the 
+ *                      remaining back-off, 0 if none is in force
+ * @param &reject_cause Address of integer in which to store the EMM
+ *                      reject cause that started it, -1 if unknown
+ */
+void SaraN2::get_backoff(uint32_t &remaining_ms, int &reject_cause)
+{
+	_smutex.lock();
+
+	uint64_t now = Kernel::get_ms_count();
+
+	remaining_ms = (_backoff_until_ms > now) ? _backoff_until_ms - now : 0;
+	reject_cause = _backoff_cause;
+
+	_smutex.unlock();
+}
+
+/** End any back-off in force and forget consecutive rejects, i.e.
+ *  after the SIM or subscription has been changed
+ */
+void SaraN2::clear_backoff()
+{
+	_smutex.lock();
+
+	_backoff_until_ms = 0;
+	_backoff_cause = -1;
+	_backoff_rejects = 0;
+
+	_smutex.unlock();
+}
+
+/** Start or clear the back-off from the registration status and 
+ *  reject cause just read by _read_cereg_report()
+ */
+void SaraN2::_update_backoff()
+{
+	if(_registration_status == SaraN2::REGISTERED_HOME_NETWORK || 
+	   _registration_status == SaraN2::REGISTERED_ROAMING)
+	{
+		_backoff_until_ms = 0;
+		_backoff_rejects = 0;
+		return;
+	}
+
+	/* Only EMM causes (cause type 0) are network rejects, and a denied
+	 * status without a cause is still treated as one
+	 */
+	bool rejected = _registration_status == SaraN2::REGISTRATION_DENIED || 
+	                (_reject_cause_type == 0 && _reject_cause > 0);
+
+	if(!rejected || _backoff_active())
+	{
+		return;
+	}
+
+	/* +CEREG does not carry the network's T3346 value, so congestion 
+	 * gets a long local timer in its place
+	 */
+	uint32_t backoff = (_reject_cause == SARAN2_EMM_CAUSE_CONGESTION) ? 
+	                   SARAN2_BACKOFF_CONGESTION_MS : SARAN2_BACKOFF_BASE_MS;
+
+	for(uint8_t i = 0; i < _backoff_rejects && backoff < SARAN2_BACKOFF_MAX_MS; i++)
+	{
+		backoff *= 2;
+	}
+
+	if(backoff > SARAN2_BACKOFF_MAX_MS)
+	{
+		backoff = SARAN2_BACKOFF_MAX_MS;
+	}
+
+	backoff += (uint64_t)backoff * (_backoff_random() % (SARAN2_BACKOFF_JITTER + 1)) / 100;
+
+	if(_backoff_rejects < 0xFF)
+	{
+		_backoff_rejects++;
+	}
+
+	_backoff_cause = (_reject_cause_type == 0) ? _reject_cause : -1;
+	_backoff_until_ms = Kernel::get_ms_count() + backoff;
+}
+
+/** Next value of the xorshift32 jitter generator, seeded on first 
+ *  use from the IMEI so that devices rejected together spread 
+ *  their retries rather than draw the same sequence after reset
+ */
+uint32_t SaraN2::_backoff_random()
+{
+	if(_backoff_seed == 0)
+	{
+		char imei[16] = "";
+
+		_parser->send("AT+CGSN=1");
+		if(_parser->recv("+CGSN: %15s", imei))
+		{
+			_parser->recv("OK");
+		}
+
+		/* FNV-1a of the IMEI, with the uptime mixed in as a fallback if
+		 * it could not be read
+		 */
+		uint32_t hash = 2166136261UL ^ (uint32_t)Kernel::get_ms_count();
+
+		for(const char *c = imei; *c != '\0'; c++)
+		{
+			hash = (hash ^ (uint8_t)*c) * 16777619UL;
+		}
+
+		_backoff_seed = (hash != 0) ? hash : 1;
+	}
+
+	_backoff_seed ^= _backoff_seed << 13;
+	_backoff_seed ^= _backoff_seed >> 17;
+	_backoff_seed ^= _backoff_seed << 5;
+
+	return _backoff_seed;
+}
+
+#endif /* SARAN2_FEATURE_BACKOFF */
+
+#if SARAN2_FAULT_INJECTION
+
+/** Access the fault injector placed between the UART and the AT
+ *  command parser, i.e. to schedule faults during a benchmark
+ *
+ * @return Pointer to the fault injector
+ */
+SaraN2FaultInjector *SaraN2::fault_injector()
+{
+	return _fault;
+}
+
+#endif /* SARAN2_FAULT_INJECTION */
+
+#if SARAN2_FEATURE_TIMELINE
+
+/** Record a timeline of every CoAP request. Enables the +CSCON URC so 
+ *  that RRC connection set up and release can be timestamped. A 
+ *  timeline is complete, and passed to the callback, when the RRC 
+ *  connection is released or, failing that, when the next CoAP 
+ *  request starts. The callback runs with the driver lock held and
+ *  must not call back into the driver
+ *
+ * @param timeline_cb Optional callback invoked with each timeline
+ * @return Indicates success or failure reason
+ */
+int SaraN2::enable_coap_timeline(Callback<void(const CoapTimeline_t &)> timeline_cb)
+{
+	_smutex.lock();
+
+	_wake_and_flush();
+
+	_parser->send("AT+CSCON=1");
+	if(!_parser->recv("OK"))
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_ENABLE_TIMELINE;
+	}
+
+	_timeline_cb = timeline_cb;
+	_timeline_enabled = true;
+	_timeline_active = false;
+	_timeline_pending = false;
+	memset(_phase_histogram, 0, sizeof(_phase_histogram));
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Stop recording CoAP request timelines and disable the +CSCON URC
+ *
+ * @return Indicates success or failure reason
+ */
+int SaraN2::disable_coap_timeline()
+{
+	_smutex.lock();
+
+	if(_timeline_pending)
+	{
+		_timeline_complete();
+	}
+
+	_timeline_enabled = false;
+	_timeline_active = false;
+
+	_wake_and_flush();
+
+	_parser->send("AT+CSCON=0");
+	if(!_parser->recv("OK"))
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_DISABLE_TIMELINE;
+	}
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Estimate a percentile of the duration of one phase of all CoAP 
+ *  requests recorded since enable_coap_timeline()
+ *
+ * @param phase Enumerated PHASE_x value
+ * @param percent Percentile to estimate, i.e. 99 for p99
+ * @param &ms Address of integer in which to store the upper bound of
+ *            the histogram bucket containing the percentile
+ * @return Indicates success or failure reason
+ */
+int SaraN2::get_coap_phase_percentile(uint8_t phase, uint8_t percent, uint32_t &ms)
+{
+	if(phase >= PHASE_COUNT)
+	{
+		return SaraN2::INVALID_TIMELINE_PHASE;
+	}
+
+	_smutex.lock();
+
+	ms = _histogram_quantile(_phase_histogram[phase], percent);
+
+	_smutex.unlock();
+
+	return SaraN2::SARAN2_OK;
+}
+
+/** Pass a completed timeline to the callback and add its phases to
+ *  the histograms
+ */
+void SaraN2::_timeline_complete()
+{
+	const CoapTimeline_t &t = _timeline;
+
+	_timeline_pending = false;
+
+	/* If the RRC connection was already up there is no connect phase and
+	 * the round trip is measured from the OK instead
+	 */
+	const uint32_t from[PHASE_COUNT] = { 0, t.write_end, t.accepted, 
+	                                     (t.connected != SARAN2_TIMELINE_NOT_SEEN) ? t.connected : t.accepted,
+	                                     t.response, t.parsed, 0 };
+	const uint32_t to[PHASE_COUNT] = { t.write_end, t.accepted, t.connected, t.response, 
+	                                   t.parsed, t.released, t.parsed };
+
+	for(int phase = 0; phase < PHASE_COUNT; phase++)
+	{
+		if(from[phase] != SARAN2_TIMELINE_NOT_SEEN && to[phase] != SARAN2_TIMELINE_NOT_SEEN && 
+		   to[phase] >= from[phase])
+		{
+			_histogram_add(_phase_histogram[phase], to[phase] - from[phase]);
+		}
+	}
+
+	if(_timeline_cb)
+	{
+		_timeline_cb(_timeline);
+	}
+}
+
+/** Out-of-band handler for +CSCON. Handles both the URC, which
+ *  carries only the connection state, and the response to 
+ *  AT+CSCON?, which the handler consumes before cscon() sees it
+ */
+void SaraN2::_cscon_urc()
+{
+	char line[16];
+	int first;
+	int second;
+
+	if(_read_line(line, sizeof(line)) <= 0)
+	{
+		return;
+	}
+
+	int count = sscanf(line, "%d,%d", &first, &second);
+
+	if(count == 2)
+	{
+		_cscon_reply[0] = first;
+		_cscon_reply[1] = second;
+		_cscon_reply_valid = true;
+		return;
+	}
+
+	if(count != 1 || (!_timeline_active && !_timeline_pending))
+	{
+		return;
+	}
+
+	uint32_t now = Kernel::get_ms_count() - _timeline_start_ms;
+
+	if(first == SaraN2::CONNECTED)
+	{
+		if(_timeline.connected == SARAN2_TIMELINE_NOT_SEEN)
+		{
+			_timeline.connected = now;
+		}
+	}
+	else if(_timeline.released == SARAN2_TIMELINE_NOT_SEEN)
+	{
+		_timeline.released = now;
+
+		if(_timeline_pending)
+		{
+			_timeline_complete();
+		}
+	}
+}
+
+#endif /* SARAN2_FEATURE_TIMELINE */
+
+/** Timeline hooks called by each CoAP request with the driver lock
+ *  held, at the start of the request and as each event is seen. 
+ *  They do nothing if SARAN2_FEATURE_TIMELINE is disabled
+ *
+ * @param event CoapTimeline_t member to timestamp
+ */
+void SaraN2::_timeline_start()
+{
+#if SARAN2_FEATURE_TIMELINE
+	if(_timeline_pending)
+	{
+		/* Give a +CSCON: 0 that arrived while the driver was idle a 
+		 * chance to close the previous timeline before it is flushed
+		 */
+		while(_parser->process_oob())
+		{
+		}
+
+		if(_timeline_pending)
+		{
+			_timeline_complete();
+		}
+	}
+
+	if(!_timeline_enabled)
+	{
+		return;
+	}
+
+	_timeline.write_end = SARAN2_TIMELINE_NOT_SEEN;
+	_timeline.accepted  = SARAN2_TIMELINE_NOT_SEEN;
+	_timeline.connected = SARAN2_TIMELINE_NOT_SEEN;
+	_timeline.response  = SARAN2_TIMELINE_NOT_SEEN;
+	_timeline.parsed    = SARAN2_TIMELINE_NOT_SEEN;
+	_timeline.released  = SARAN2_TIMELINE_NOT_SEEN;
+	_timeline.status    = SaraN2::SARAN2_OK;
+
+	_timeline_start_ms = Kernel::get_ms_count();
+	_timeline_active = true;
+#endif
+}
+
+void SaraN2::_timeline_mark(uint32_t CoapTimeline_t::*event)
+{
+#if SARAN2_FEATURE_TIMELINE
+	if(_timeline_active)
+	{
+		_timeline.*event = Kernel::get_ms_count() - _timeline_start_ms;
+	}
+#endif
+}
+
+/** Record the outcome and latency of a CoAP request in the health 
+ *  counters and close its timeline. Parts belonging to disabled 
+ *  features do nothing
+ *
+ * @param start Kernel millisecond count at the start of the request
+ * @param status Return code of the request
+ * @return status, so that it can be used in a return statement
+ */
+int SaraN2::_finish_coap_request(uint64_t start, int status)
+{
+	_smutex.lock();
+
+#if SARAN2_FEATURE_HEALTH
+	_health.coap_requests++;
+
+	if(status != SaraN2::SARAN2_OK)
+	{
+		_health.coap_failures++;
+	}
+	else
+	{
+		_histogram_add(_health.coap_latency, Kernel::get_ms_count() - start);
+	}
+#endif
+
+#if SARAN2_FEATURE_TIMELINE
+	if(_timeline_active)
+	{
+		_timeline.status = status;
+		_timeline_active = false;
+		_timeline_pending = true;
+
+		if(_timeline.released != SARAN2_TIMELINE_NOT_SEEN)
+		{
+			_timeline_complete();
+		}
+	}
+#endif
+
+	_smutex.unlock();
+
+	return status;
+}
+
+/** Add a duration to a SARAN2_LATENCY_BUCKETS latency histogram
+ *
+ * @param *histogram Pointer to the histogram buckets
+ * @param elapsed_ms Duration in milliseconds
+ * @param bucket_ms Upper bound of the first bucket in milliseconds
+ */
+void SaraN2::_histogram_add(uint32_t *histogram, uint64_t elapsed_ms, uint32_t bucket_ms)
+{
+	int bucket = 0;
+
+	while(bucket < SARAN2_LATENCY_BUCKETS - 1 && elapsed_ms >= ((uint64_t)bucket_ms << bucket))
+	{
+		bucket++;
+	}
+
+	histogram[bucket]++;
+}
+
+/** Estimate a quantile of a SARAN2_LATENCY_BUCKETS latency histogram
+ *
+ * @param *histogram Pointer to the histogram buckets
+ * @param percent Quantile to estimate, i.e. 99 for p99
+ * @param bucket_ms Upper bound of the first bucket in milliseconds
+ * @return Upper bound of the bucket containing the quantile in ms,
+ *         or 0 if the histogram is empty
+ */
+uint32_t SaraN2::_histogram_quantile(const uint32_t *histogram, uint8_t percent, uint32_t bucket_ms)
+{
+	uint32_t total = 0;
+
+	for(int i = 0; i < SARAN2_LATENCY_BUCKETS; i++)
+	{
+		total += histogram[i];
+	}
+
+	if(total == 0)
+	{
+		return 0;
+	}
+
+	uint32_t target = ((uint64_t)total * percent + 99) / 100;
+	uint32_t count = 0;
+
+	for(int i = 0; i < SARAN2_LATENCY_BUCKETS; i++)
+	{
+		count += histogram[i];
+		if(count >= target)
+		{
+			return bucket_ms << i;
+		}
+	}
+
+	return bucket_ms << (SARAN2_LATENCY_BUCKETS - 1);
+}
+
+/** Seed timeout and bounds of each tracked command, in milliseconds. Seeds
+ *  of the slow commands cover the worst case in the u-blox AT manual
+ */
+const SaraN2::CommandLimits_t SaraN2::_command_limits[COMMAND_COUNT] =
+{
+	{     0,  50,   1000 }, /* AT */
+	{     0,  50,   1000 }, /* AT+CSQ */
+	{     0,  50,   1000 }, /* AT+CEREG? */
+	{ 10000, 200,  30000 }, /* AT+CFUN */
+	{ 10000, 200,  60000 }, /* AT+CGATT */
+	{ 10000, 200, 180000 }, /* AT+COPS */
+	{  2000, 100,  10000 }  /* AT+UCOAP=6 */
+};
+
+/** Timeout of a tracked command, learned from its observed latency 
+ *  if SARAN2_FEATURE_ADAPTIVE_TIMEOUT is enabled and otherwise its 
+ *  seed. Must be called with the driver lock held
+ *
+ * @param command Enumerated COMMAND_x value
+ * @return Timeout in milliseconds
+ */
+uint32_t SaraN2::_command_timeout(uint8_t command)
+{
+	const CommandLimits_t &limits = _command_limits[command];
+	uint32_t timeout = (limits.seed_ms != 0) ? limits.seed_ms : _at_timeout_ms;
+
+#if SARAN2_FEATURE_ADAPTIVE_TIMEOUT
+	uint32_t samples = 0;
+
+	for(int i = 0; i < SARAN2_LATENCY_BUCKETS; i++)
+	{
+		samples += _command_latency[command][i];
+	}
+
+	if(samples >= SARAN2_ADAPTIVE_SAMPLES)
+	{
+		timeout = _histogram_quantile(_command_latency[command], 99, SARAN2_ADAPTIVE_BUCKET_MS) * SARAN2_ADAPTIVE_MARGIN;
+
+		if(timeout < limits.min_ms)
+		{
+			timeout = limits.min_ms;
+		}
+		else if(timeout > limits.max_ms)
+		{
+			timeout = limits.max_ms;
+		}
+	}
+#endif
+
+	return timeout;
+}
+
+/** Apply the timeout of a tracked command before sending it and
+ *  note the time. Must be called with the driver lock held
+ *
+ * @param command Enumerated COMMAND_x value
+ */
+void SaraN2::_command_start(uint8_t command)
+{
+	_parser->set_timeout(_command_timeout(command));
+
+	_command_start_ms = Kernel::get_ms_count();
+}
+
+/** Record the response time of a tracked command and restore the 
+ *  operator AT timeout. A timeout is recorded as a response at the
+ *  timeout, so that a command that times out falsely gets longer
+ *  timeouts until it stops doing so
+ *
+ * @param command Enumerated COMMAND_x value
+ * @param ok Whether the expected response was received
+ * @return ok, so that it can be used in a condition
+ */
+bool SaraN2::_command_end(uint8_t command, bool ok)
+{
+#if SARAN2_FEATURE_ADAPTIVE_TIMEOUT
+	uint32_t *histogram = _command_latency[command];
+	uint32_t samples = 0;
+
+	/* A timeout lands one bucket above the current timeout, so p99 moves up */
+	uint64_t elapsed = ok ? Kernel::get_ms_count() - _command_start_ms : 2 * (uint64_t)_command_timeout(command);
+
+	_histogram_add(histogram, elapsed, SARAN2_ADAPTIVE_BUCKET_MS);
+
+	for(int i = 0; i < SARAN2_LATENCY_BUCKETS; i++)
+	{
+		samples += histogram[i];
+	}
+
+	if(samples >= SARAN2_ADAPTIVE_WINDOW)
+	{
+		for(int i = 0; i < SARAN2_LATENCY_BUCKETS; i++)
+		{
+			histogram[i] = (histogram[i] + 1) / 2;
+		}
+	}
+#endif
+
+	_parser->set_timeout(_at_timeout_ms);
+
+	return ok;
+}
+
+#if SARAN2_FEATURE_FOTA
+
+/** Send a single firmware package segment with AT+NFWUPD=1
+ *
+ * @param segment Segment sequence number
+ * @param *data Pointer to the segment data
+ * @param length Number of bytes in the segment
+ * @return True if the module acknowledged the segment
+ */
+bool SaraN2::_send_firmware_segment(uint16_t segment, const uint8_t *data, uint16_t length)
+{
+	uint8_t checksum = 0;
+
+	for(uint16_t i = 0; i < length; i++)
+	{
+		checksum ^= data[i];
+	}
+
+	_wake_and_flush();
+
+	/* The encoded segment is far larger than ATCmdParser's send buffer, so 
+	 * the command is written out in pieces
+	 */
+	_parser->printf("AT+NFWUPD=1,%u,%u,", segment, length);
+	_write_hex(data, length);
+	_parser->printf(",%02X\r\n", checksum);
+
+	return _parser->recv("OK");
+}
+
+#endif /* SARAN2_FEATURE_FOTA */
+
+#if SARAN2_FEATURE_PSM
+
+/** Read the PSM setting and both PSM timers with a single AT+CPSMS?. 
+ *  Must be called with the driver lock held
+ *
+ * @param &psm Address of integer in which to store the PSM setting
+ * @param *t3412 Pointer to Char array of at least 9 bytes in which to 
+ *               store the T3412 binary string
+ * @param *t3324 Pointer to Char array of at least 9 bytes in which to
+ *               store the T3324 binary string
+ * @return True if the settings were read
+ */
+bool SaraN2::_read_psm_settings(int &psm, char *t3412, char *t3324)
+{
+    _parser->send("AT+CPSMS?");
+    if(!_parser->recv("+CPSMS: %d,,,\"%8s\",\"%8s\"", &psm, t3412, t3324) ||
+       !_parser->recv("OK"))
+    {
+        return false;
+    }
+
+    t3412[8] = '\0';
+    t3324[8] = '\0';
+
+    return true;
+}
+
+/** Query +CEREG at level 4 and store the registration status, reject
+ *  cause and granted PSM timers. The URC level is restored to 0 
+ *  afterwards. Must be called with the driver lock held
+ *
+ * @return True if the report was read
+ */
+bool SaraN2::_read_cereg_report()
+{
+	_parser->send("AT+CEREG=4");
+	if(!_parser->recv("OK"))
+	{
+		return false;
+	}
+
+	/* +CEREG: <n>,<stat>[,[<tac>],[<ci>],[<AcT>][,<cause_type>,<reject_cause>]
+	 *         [,[<Active-Time>],[<Periodic-TAU>]]]
+	 */
+	const char *fields[9];
+	int lengths[9];
+	int count = 0;
+
+	_parser->send("AT+CEREG?");
+	if(_parser->recv("+CEREG: "))
+	{
+		int length = _read_line(_line_buffer, sizeof(_line_buffer));
+		if(length > 0)
+		{
+			count = _split_fields(_line_buffer, length, fields, lengths, 9);
+		}
+	}
+
+	bool ok = count >= 2 && _parser->recv("OK");
+
+	if(ok)
+	{
+		_registration_status = strtol(fields[1], NULL, 10);
+
+		if(count > 3 && lengths[3] > 0)
+		{
+			_last_cell_id = strtoul(fields[3], NULL, 16);
+		}
+
+		_reject_cause_type = (count > 5 && lengths[5] > 0) ? strtol(fields[5], NULL, 10) : -1;
+		_reject_cause = (count > 6 && lengths[6] > 0) ? strtol(fields[6], NULL, 10) : -1;
+
+		_granted_t3324[0] = '\0';
+		_granted_t3412[0] = '\0';
+
+		if(count > 7 && lengths[7] == 8)
+		{
+			memcpy(_granted_t3324, fields[7], 8);
+			_granted_t3324[8] = '\0';
+		}
+
+		if(count > 8 && lengths[8] == 8)
+		{
+			memcpy(_granted_t3412, fields[8], 8);
+			_granted_t3412[8] = '\0';
+		}
+
+		/* An absent Active-Time, or the GPRS Timer 2 unit "111", means the 
+		 * network has deactivated T3324 and the UE will never enter PSM
+		 */
+		_psm_granted = _granted_t3324[0] != '\0' && strncmp(_granted_t3324, "111", 3) != 0;
+		_psm_granted_known = true;
+
+#if SARAN2_FEATURE_BACKOFF
+		_update_backoff();
+#endif
+	}
+
+	_parser->send("AT+CEREG=0");
+	_parser->recv("OK");
+
+	return ok;
+}
+
+/** Is the PSM fallback currently in effect?
+ *
+ * @return True if the fallback is enabled and PSM has not been granted
+ */
+bool SaraN2::_psm_fallback_active()
+{
+	return _psm_fallback && _psm_granted_known && !_psm_granted;
+}
+
+#endif /* SARAN2_FEATURE_PSM */
+
+#if SARAN2_FEATURE_COAP_METHODS
+
+/** Send a confirmable CoAP request on the socket and wait for its 
+ *  piggybacked or separate response
+ *
+ * @param code CoAP method code
+ * @param fail Return code if the module does not accept the request
+ * @param *send_data Pointer to the request body
+ * @param length Number of bytes in the request body
+ * @param content_format CoAP Content-Format of the body
+ * @param *recv_data Pointer to a byte array of SARAN2_MAX_COAP_PAYLOAD
+ *                   bytes in which to store the response payload
+ * @param &recv_length Address of integer in which to store the
+ *                     response payload length
+ * @param &response_code Address of integer where the CoAP response 
+ *                       class will be stored
+ * @return Indicates success or failure reason
+ */
+int SaraN2::_coap_socket_request(uint8_t code, int fail, const uint8_t *send_data, size_t length, 
+                                 uint16_t content_format, uint8_t *recv_data, size_t &recv_length, 
+                                 int &response_code)
+{
+	uint64_t start = Kernel::get_ms_count();
+
+	_smutex.lock();
+
+	uint8_t header[SARAN2_COAP_HEADER_SIZE];
+	size_t header_length = _coap_header(code, content_format, length != 0, header);
+
+	if(header_length + ((length != 0) ? 1 + length : 0) > SARAN2_COAP_SOCKET_MAX_DATAGRAM)
+	{
+		_smutex.unlock();
+		return SaraN2::COAP_REQUEST_TOO_LARGE;
+	}
+
+	if(_backoff_active())
+	{
+		_smutex.unlock();
+		return SaraN2::FAIL_BACKOFF_ACTIVE;
+	}
+
+	if(!_take_uplink_token())
+	{
+		_smutex.unlock();
+		return SaraN2::UPLINK_RATE_LIMITED;
+	}
+
+	_timeline_start();
+
+	_wake_and_flush();
+
+	if((_coap_socket < 0 && !_open_coap_socket()) || _coap_target_ip[0] == '\0')
+	{
+		_smutex.unlock();
+		return _finish_coap_request(start, SaraN2::FAIL_OPEN_COAP_SOCKET);
+	}
+
+	_send_coap_datagram(header, header_length, send_data, length);
+	_timeline_mark(&CoapTimeline_t::write_end);
+
+	/* AT+NSOST replies <socket>,<length> before the OK */
+	if(!_parser->recv("OK"))
+	{
+		_smutex.unlock();
+		return _finish_coap_request(start, fail);
+	}
+
+	_timeline_mark(&CoapTimeline_t::accepted);
+
+	/* The token is the message ID of the request, so both a piggybacked
+	 * response and a separate one can be matched to it
+	 */
+	uint64_t deadline = Kernel::get_ms_count() + _coap_timeout_ms;
+
+	while(Kernel::get_ms_count() < deadline)
+	{
+		bool truncated;
+		int datagram = _read_coap_datagram(deadline - Kernel::get_ms_count(), truncated);
+
+		if(datagram < 0)
+		{
+			break;
+		}
+
+		const uint8_t *message = (const uint8_t *)_line_buffer;
+		uint8_t tkl = message[0] & 0x0F;
+
+		if(datagram < 4 || (message[0] >> 6) != 1 || datagram < 4 + tkl)
+		{
+			continue;
+		}
+
+		uint8_t type = (message[0] >> 4) & 0x03;
+		bool ours = tkl == 2 && message[4] == header[4] && message[5] == header[5];
+
+		if(message[1] == 0)
+		{
+			/* An empty message answering ours is either a RST, rejecting
+			 * the request, or an ACK, after which the response follows 
+			 * separately
+			 */
+			if(type == 3 && message[2] == header[2] && message[3] == header[3])
+			{
+				_smutex.unlock();
+				return _finish_coap_request(start, SaraN2::COAP_RESET_RECEIVED);
+			}
+
+			continue;
+		}
+
+		if(!ours)
+		{
+			continue;
+		}
+
+		_timeline_mark(&CoapTimeline_t::response);
+
+		response_code = message[1] >> 5;
+
+		/* Skip the options to the payload marker */
+		int i = 4 + tkl;
+
+		while(i < datagram && message[i] != 0xFF)
+		{
+			uint8_t delta = message[i] >> 4;
+			int option_length = message[i] & 0x0F;
+
+			i++;
+			i += (delta == 13) ? 1 : (delta == 14) ? 2 : 0;
+
+			if(option_length == 13)
+			{
+				option_length = (i < datagram) ? message[i] + 13 : 0;
+				i++;
+			}
+			else if(option_length == 14)
+			{
+				option_length = (i + 1 < datagram) ? ((message[i] << 8) | message[i + 1]) + 269 : 0;
+				i += 2;
+			}
+
+			i += option_length;
+		}
+
+		recv_length = 0;
+
+		if(i + 1 < datagram)
+		{
+			recv_length = datagram - (i + 1);
+			if(recv_length > SARAN2_MAX_COAP_PAYLOAD)
+			{
+				recv_length = SARAN2_MAX_COAP_PAYLOAD;
+			}
+
+			memcpy(recv_data, &message[i + 1], recv_length);
+		}
+
+		if(type == 0)
+		{
+			/* Acknowledge a confirmable separate response */
+			uint8_t ack[4] = { 0x60, 0x00, message[2], message[3] };
+
+			_send_coap_datagram(ack, sizeof(ack), NULL, 0);
+			_parser->recv("OK");
+		}
+
+		_timeline_mark(&CoapTimeline_t::parsed);
+
+		_smutex.unlock();
+
+		return _finish_coap_request(start, truncated ? SaraN2::COAP_RESPONSE_TRUNCATED : SaraN2::SARAN2_OK);
+	}
+
+#if SARAN2_FEATURE_HEALTH
+	_health.timeouts++;
+#endif
+
+	_smutex.unlock();
+
+	return _finish_coap_request(start, SaraN2::FAIL_PARSE_RESPONSE);
+}
+
+/** Open the UDP socket of the CoAP socket path. If the local port is
+ *  still bound, i.e. by the driver's socket from before an MCU-only
+ *  reset that no warm state carried over, the next ports are tried.
+ *  Sockets the driver did not open are never closed. Must be called
+ *  with the driver lock held
+ *
+ * @return True if the socket is open
+ */
+bool SaraN2::_open_coap_socket()
+{
+	for(int port = 0; port < SARAN2_COAP_SOCKET_PORTS; port++)
+	{
+		int socket;
+
+		_parser->flush();
+		_parser->send("AT+NSOCR=\"DGRAM\",17,%d,1", SARAN2_COAP_SOCKET_LOCAL_PORT + port);
+		if(_parser->recv("%d", &socket) && _parser->recv("OK"))
+		{
+			_coap_socket = socket;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Build the CoAP header, token, Uri-Path and Content-Format options
+ *  of a request
+ *
+ * @param code CoAP method code
+ * @param content_format CoAP Content-Format, only sent if with_body
+ * @param with_body Whether the request has a body
+ * @param *header Pointer to SARAN2_COAP_HEADER_SIZE bytes in which 
+ *                to build the header
+ * @return Number of bytes written
+ */
+size_t SaraN2::_coap_header(uint8_t code, uint16_t content_format, bool with_body, uint8_t *header)
+{
+	uint16_t message_id = ++_coap_message_id;
+	size_t n = 0;
+
+	/* Version 1, confirmable, two-byte token equal to the message ID */
+	header[n++] = 0x42;
+	header[n++] = code;
+	header[n++] = message_id >> 8;
+	header[n++] = message_id;
+	header[n++] = message_id >> 8;
+	header[n++] = message_id;
+
+	/* Uri-Path (11), one option per segment. The path is at most 
+	 * SARAN2_COAP_PATH_SIZE, so segments never need a two-byte length
+	 */
+	uint8_t last = 0;
+	const char *segment = _coap_target_path;
+
+	while(*segment != '\0')
+	{
+		size_t length = strcspn(segment, "/");
+
+		if(length > 0)
+		{
+			uint8_t delta = 11 - last;
+
+			if(length < 13)
+			{
+				header[n++] = (delta << 4) | length;
+			}
+			else
+			{
+				header[n++] = (delta << 4) | 13;
+				header[n++] = length - 13;
+			}
+
+			memcpy(&header[n], segment, length);
+			n += length;
+			last = 11;
+		}
+
+		segment += length;
+		if(*segment == '/')
+		{
+			segment++;
+		}
+	}
+
+	/* Content-Format (12) as a minimal-length unsigned integer */
+	if(with_body)
+	{
+		uint8_t delta = 12 - last;
+		uint8_t length = (content_format == 0) ? 0 : (content_format < 256) ? 1 : 2;
+
+		header[n++] = (delta << 4) | length;
+
+		if(length == 2)
+		{
+			header[n++] = content_format >> 8;
+		}
+
+		if(length >= 1)
+		{
+			header[n++] = content_format;
+		}
+	}
+
+	return n;
+}
+
+/** Send a CoAP message, header and optional payload, as one datagram 
+ *  to the target. The payload is hex-encoded straight from the 
+ *  caller's buffer. Must be called with the driver lock held
+ *
+ * @param *header Pointer to the CoAP header and options
+ * @param header_length Number of bytes in the header
+ * @param *payload Pointer to the payload
+ * @param length Number of bytes in the payload, 0 for none
+ */
+void SaraN2::_send_coap_datagram(const uint8_t *header, size_t header_length, 
+                                 const uint8_t *payload, size_t length)
+{
+	static const uint8_t payload_marker = 0xFF;
+
+	size_t total = header_length + ((length != 0) ? 1 + length : 0);
+
+	_parser->printf("AT+NSOST=%d,\"%s\",%u,%u,\"", _coap_socket, _coap_target_ip, 
+	                _coap_target_port, (unsigned int)total);
+	_write_hex(header, header_length);
+
+	if(length != 0)
+	{
+		_write_hex(&payload_marker, 1);
+		_write_hex(payload, length);
+	}
+
+	_parser->printf("\"\r\n");
+}
+
+/** Wait for a datagram on the socket and read its first 
+ *  SARAN2_COAP_SOCKET_READ bytes into the line buffer, draining the
+ *  rest from the module. Must be called with the driver lock held
+ *
+ * @param timeout_ms Time to wait for the datagram
+ * @param &truncated Address of boolean in which to store whether
+ *                   bytes beyond SARAN2_COAP_SOCKET_READ were dropped
+ * @return Length of the datagram kept or -1 if none was received
+ */
+int SaraN2::_read_coap_datagram(uint32_t timeout_ms, bool &truncated)
+{
+	int socket;
+	int available;
+
+	_parser->set_timeout(timeout_ms);
+
+	bool notified = _parser->recv("+NSONMI: %d,%d", &socket, &available);
+
+	_parser->set_timeout(_at_timeout_ms);
+
+	if(!notified || socket != _coap_socket)
+	{
+		return -1;
+	}
+
+	if(available > SARAN2_COAP_SOCKET_READ)
+	{
+		available = SARAN2_COAP_SOCKET_READ;
+	}
+
+	const char *data;
+	int data_length;
+	int remaining;
+
+	_parser->send("AT+NSORF=%d,%d", _coap_socket, available);
+	if(!_read_socket_reply(_line_buffer, sizeof(_line_buffer), data, data_length, remaining))
+	{
+		return -1;
+	}
+
+	/* Decoding in place is safe, as each byte is written behind the hex
+	 * digits still to be read
+	 */
+	int datagram = hex_decode(data, data_length, (uint8_t *)_line_buffer);
+
+	/* Anything left unread would be returned by the next AT+NSORF in 
+	 * place of the next response, so read it into the unused end of the 
+	 * buffer and drop it
+	 */
+	truncated = remaining > 0;
+
+	char *spare = &_line_buffer[SARAN2_COAP_SOCKET_READ];
+	int spare_size = sizeof(_line_buffer) - SARAN2_COAP_SOCKET_READ;
+
+	while(remaining > 0)
+	{
+		_parser->send("AT+NSORF=%d,%d", _coap_socket, SARAN2_COAP_SOCKET_DRAIN);
+		if(!_read_socket_reply(spare, spare_size, data, data_length, remaining))
+		{
+			break;
+		}
+	}
+
+	return datagram;
+}
+
+/** Read one AT+NSORF reply line. Must be called with the driver 
+ *  lock held
+ *
+ * @param *buffer Pointer to the byte array to read the line into
+ * @param size Size of buffer
+ * @param &data Address of pointer in which to store the hex data
+ * @param &data_length Address of integer in which to store its length
+ * @param &remaining Address of integer in which to store the bytes 
+ *                   of the datagram still unread
+ * @return True if the reply was read
+ */
+bool SaraN2::_read_socket_reply(char *buffer, int size, const char *&data, int &data_length, int &remaining)
+{
+	int length;
+	do
+	{
+		length = _read_line(buffer, size);
+	}
+	while(length == 0);
+
+	/* <socket>,<ip_addr>,<port>,<length>,<data>,<remaining_length> */
+	const char *fields[6];
+	int lengths[6];
+	int count = (length > 0) ? _split_fields(buffer, length, fields, lengths, 6) : 0;
+
+	if(count < 5 || !_parser->recv("OK"))
+	{
+		return false;
+	}
+
+	data = fields[4];
+	data_length = lengths[4];
+	remaining = (count > 5) ? strtol(fields[5], NULL, 10) : 0;
+
+	return true;
+}
+
+#endif /* SARAN2_FEATURE_COAP_METHODS */
+
+/** Hex-encode binary data straight onto the AT interface in small 
+ *  pieces, so that payloads larger than ATCmdParser's send buffer 
+ *  never need to be encoded into memory in full
+ *
+ * @param *data Pointer to the data to write
+ * @param length Number of bytes to write
+ */
+void SaraN2::_write_hex(const uint8_t *data, size_t length)
+{
+	char chunk[64];
+	const size_t per_chunk = sizeof(chunk) / 2;
+
+	for(size_t i = 0; i < length; i += per_chunk)
+	{
+		size_t count = (length - i > per_chunk) ? per_chunk : length - i;
+
+		hex_encode(&data[i], count, chunk);
+		_parser->write(chunk, 2 * count);
+	}
+}
+
+/** Find the first occurrence of either of two delimiters in buffered
+ *  response data, testing a 32-bit word at a time
+ *
+ * @param *data Pointer to the data to search
+ * @param from Index at which to start searching
+ * @param to Index at which to stop searching
+ * @param first First delimiter to search for
+ * @param second Second delimiter to search for
+ * @return Index of the delimiter, or to if neither was found
+ */
+int SaraN2::_find_delimiter(const char *data, int from, int to, char first, char second)
+{
+	const uint32_t ones = 0x01010101UL;
+	const uint32_t highs = 0x80808080UL;
+	const uint32_t first_word = ones * (uint8_t)first;
+	const uint32_t second_word = ones * (uint8_t)second;
+
+	int i = from;
+
+	/* A byte of (word ^ pattern) is zero where the word matches the delimiter,
+	 * and ((v - 0x01..) & ~v & 0x80..) is non-zero iff v contains a zero byte
+	 */
+	for(; i + 4 <= to; i += 4)
+	{
+		uint32_t word;
+		memcpy(&word, &data[i], sizeof(word));
+
+		uint32_t a = word ^ first_word;
+		uint32_t b = word ^ second_word;
+
+		if(((a - ones) & ~a & highs) | ((b - ones) & ~b & highs))
+		{
+			break;
+		}
+	}
+
+	for(; i < to; i++)
+	{
+		if(data[i] == first || data[i] == second)
+		{
+			return i;
+		}
+	}
+
+	return to;
+}
+
+/** Split a buffered response line into comma-separated fields. Quoted
+ *  fields are returned without their quotes and may contain commas.
+ *  Fields point into line, nothing is copied
+ *
+ * @param *line Pointer to the response line
+ * @param length Length of the response line
+ * @param **fields Array in which to store a pointer to each field
+ * @param *lengths Array in which to store the length of each field
+ * @param max_fields Number of elements in fields and lengths
+ * @return Number of fields found
+ */
+int SaraN2::_split_fields(const char *line, int length, const char **fields, int *lengths, int max_fields)
+{
+	int count = 0;
+	int i = 0;
+
+	while(count < max_fields)
+	{
+		if(i < length && line[i] == '"')
+		{
+			int close = _find_delimiter(line, i + 1, length, '"', '"');
+
+			fields[count] = &line[i + 1];
+			lengths[count] = close - (i + 1);
+
+			i = _find_delimiter(line, close, length, ',', ',');
+		}
+		else
+		{
+			int comma = _find_delimiter(line, i, length, ',', ',');
+
+			fields[count] = &line[i];
+			lengths[count] = comma - i;
+
+			i = comma;
+		}
+
+		count++;
+
+		if(i >= length)
+		{
+			break;
+		}
+
+		i++; 
+	}
+
+	return count;
+}
+
+/** Wake the module if it may be asleep, then discard any stale 
+ *  input. Called with the driver lock held before each command.
+ *  Only flushes if SARAN2_FEATURE_WAKE is disabled
+ */
+void SaraN2::_wake_and_flush()
+{
+#if SARAN2_FEATURE_WAKE
+	uint64_t now = Kernel::get_ms_count();
+
+	bool idle = _wake_idle_ms != 0 && _last_command_ms != 0 && now - _last_command_ms >= _wake_idle_ms;
+
+	if(_vint.read() == 0 || idle)
+	{
+		/* The first bytes sent to a sleeping module are lost while its UART
+		 * wakes, so retry a short "AT" rather than let the real command 
+		 * wait out its full timeout
+		 */
+		bool awake = false;
+		uint64_t ready = 0;
+
+		_parser->set_timeout(SARAN2_WAKE_ATTEMPT_MS);
+
+		for(int attempt = 0; attempt < SARAN2_WAKE_ATTEMPTS && !awake; attempt++)
+		{
+			_parser->flush();
+			_parser->send("AT");
+			awake = _parser->recv("OK");
+		}
+
+		if(awake)
+		{
+			ready = Kernel::get_ms_count();
+
+			/* The OK received may answer an earlier probe that was slow to
+			 * reply, so let any later probes' OKs arrive and discard them
+			 * before the real command can mistake one for its own response
+			 */
+			while(_parser->recv("OK"))
+			{
+			}
+		}
+
+		_parser->set_timeout(_at_timeout_ms);
+
+		uint32_t elapsed = (awake ? ready : Kernel::get_ms_count()) - now;
+
+		_wake_stats.wakes++;
+		_wake_stats.last_ms = elapsed;
+
+		if(elapsed > _wake_stats.max_ms)
+		{
+			_wake_stats.max_ms = elapsed;
+		}
+
+		if(!awake)
+		{
+			_wake_stats.failures++;
+		}
+	}
+
+	_last_command_ms = Kernel::get_ms_count();
+#endif
+
+	_parser->flush();
+}
+
+/** Take one uplink from the token bucket, reading the APN rate 
+ *  control first if an attach has made it stale. Called with the
+ *  driver lock held before each CoAP request. Always succeeds if
+ *  SARAN2_FEATURE_RATE_CONTROL is disabled
+ *
+ * @return True if the uplink may be sent
+ */
+bool SaraN2::_take_uplink_token()
+{
+#if SARAN2_FEATURE_RATE_CONTROL
+	if(_rate_stale)
+	{
+		/* One attempt per attach, so a module without AT+CGAPNRC 
+		 * support is not queried before every request
+		 */
+		_rate_stale = false;
+		_wake_and_flush();
+		_read_apn_rate_control();
+	}
+
+	if(!_rate_pacing || _rate_max == 0)
+	{
+		return true;
+	}
+
+	_refill_uplink_tokens();
+
+	if(_rate_credit < _rate_unit_ms)
+	{
+		_rate_deferred++;
+		return false;
+	}
+
+	_rate_credit -= _rate_unit_ms;
+#endif
+
+	return true;
+}
+
+/** Is an attach or uplink currently forbidden by a back-off? Called
+ *  with the driver lock held. Always false if SARAN2_FEATURE_BACKOFF
+ *  is disabled
+ *
+ * @return True if the request must not be sent
+ */
+bool SaraN2::_backoff_active()
+{
+#if SARAN2_FEATURE_BACKOFF
+	return _backoff_until_ms != 0 && Kernel::get_ms_count() < _backoff_until_ms;
+#else
+	return false;
+#endif
+}
+
+/** Read the reject cause with a +CEREG report after a failed or 
+ *  denied registration, starting a back-off if the network 
+ *  rejected the device. Called with the driver lock held. Does 
+ *  nothing if SARAN2_FEATURE_BACKOFF is disabled
+ */
+void SaraN2::_check_registration_reject()
+{
+#if SARAN2_FEATURE_BACKOFF
+	/* Polling cereg() during a back-off must not lengthen it */
+	if(!_backoff_active())
+	{
+		_wake_and_flush();
+		_read_cereg_report();
+	}
+#endif
+}
+
+/** Read a single line from the module, without the trailing CR LF
+ *
+ * @param *buffer Pointer to a byte array in which to store the line
+ * @param size Size of buffer, including space for the terminator
+ * @return Length of the line or -1 if nothing was received
+ */
+int SaraN2::_read_line(char *buffer, int size)
+{
+	int length = 0;
+	bool received = false;
+
+	while(true)
+	{
+		int byte = _parser->getc();
+
+		if(byte == -1)
+		{
+			break;
+		}
+
+		received = true;
+
+		if(byte == '\n')
+		{
+			break;
+		}
+
+		if(byte != '\r' && length < size - 1)
+		{
+			buffer[length++] = byte;
+		}
+	}
+
+	buffer[length] = '\0';
+
+	return received ? length : -1;
+}
+
+#if SARAN2_FEATURE_TIME
+
+/** Parse a "yy/MM/dd,hh:mm:ss[+-zz]" network time string and update
+ *  the cached network time
+ *
+ * @param *text Pointer to the string containing the network time
+ * @param error_ms Error of the network time at the point of receipt
+ * @return True if a time was found and parsed
+ */
+bool SaraN2::_update_network_time(const char *text, uint32_t error_ms)
+{
+	/* NITZ URCs carry the time zone before the time, so locate the date by
+	 * its first '/' rather than by field position
+	 */
+	const char *date = strchr(text, '/');
+	if(date == NULL || date - text < 2)
+	{
+		return false;
+	}
+
+	int year, month, day, hour, minute, second;
+	int zone = 0;
+
+	int fields = sscanf(date - 2, "%d/%d/%d,%d:%d:%d%d", &year, &month, &day, 
+	                    &hour, &minute, &second, &zone);
+	if(fields < 6 || month < 1 || month > 12 || day < 1 || day > 31)
+	{
+		return false;
+	}
+
+	/* Days since the epoch from a proleptic Gregorian civil date */
+	year += 2000;
+	int y = (month <= 2) ? year - 1 : year;
+	int era = y / 400;
+	int yoe = y - era * 400;
+	int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	int64_t days = (int64_t)era * 146097 + doe - 719468;
+
+	int64_t seconds = days * 86400 + hour * 3600 + minute * 60 + second;
+
+	/* The true time now lies between the truncated second and error_ms
+	 * after it, so centre the estimate within that interval
+	 */
+	CriticalSectionLock lock;
+
+	_time_base_ms = (uint64_t)seconds * 1000 + error_ms / 2;
+	_time_ref_ms = Kernel::get_ms_count();
+	_time_base_error_ms = (error_ms + 1) / 2;
+	if(fields == 7)
+	{
+		_time_zone = zone;
+	}
+	_time_synchronised = true;
+
+	return true;
+}
+
+/** Out-of-band handler for +CTZV and +CTZEU NITZ URCs
+ */
+void SaraN2::_nitz_urc()
+{
+	char line[48];
+
+	if(_read_line(line, sizeof(line)) > 0)
+	{
+		_update_network_time(line, 1000);
+
+		/* The URCs lead with the time zone, <tz>[,<dst>][,<time>], which may
+		 * be quoted, and it applies even when no time is included
+		 */
+		const char *tz = line + strspn(line, " \"");
+		int zone;
+
+		if(sscanf(tz, "%d", &zone) == 1)
+		{
+			CriticalSectionLock lock;
+
+			_time_zone = zone;
+		}
+	}
+}
+
+#endif /* SARAN2_FEATURE_TIME */
+
 #endif
\ No newline at end of file
@@ -12,11 +12,250 @@
 /** Includes 
  */
 #include <mbed.h>
+#include "SaraN2FaultInjector.h"
+#include "SaraN2SurveyLog.h"
+
+/** Feature selection. Each command family can be compiled out by defining
+ *  its flag as 0, either directly or through the sara-n2-driver options in 
+ *  mbed_app.json, so that products only pay for what they use
+ */
+#ifndef SARAN2_FEATURE_ASYNC_BOOT
+#define SARAN2_FEATURE_ASYNC_BOOT 1 /* non-blocking start-up with begin() */
+#endif
+
+#ifndef SARAN2_FEATURE_COAP_PROFILES
+#define SARAN2_FEATURE_COAP_PROFILES 1 /* CoAP profile, destination and PDU header configuration */
+#endif
+
+#ifndef SARAN2_FEATURE_COAP
+#define SARAN2_FEATURE_COAP 1 /* CoAP GET, DELETE, PUT and POST requests */
+#endif
+
+#ifndef SARAN2_FEATURE_PSM
+#define SARAN2_FEATURE_PSM 1 /* Power Save Mode control and T3412/T3324 timers */
+#endif
+
+#ifndef SARAN2_FEATURE_NCONFIG
+#define SARAN2_FEATURE_NCONFIG 1 /* AT+NCONFIG UE configuration */
+#endif
+
+#ifndef SARAN2_FEATURE_RADIO
+#define SARAN2_FEATURE_RADIO 1 /* radio control, GPRS attach and network registration */
+#endif
+
+#ifndef SARAN2_FEATURE_STATS
+#define SARAN2_FEATURE_STATS 1 /* AT+NUESTATS operation statistics */
+#endif
+
+#ifndef SARAN2_FEATURE_TIME
+#define SARAN2_FEATURE_TIME 1 /* cached network time service */
+#endif
+
+#ifndef SARAN2_FEATURE_FOTA
+#define SARAN2_FEATURE_FOTA 1 /* modem firmware update over AT+NFWUPD */
+#endif
+
+#ifndef SARAN2_FEATURE_HEALTH
+#define SARAN2_FEATURE_HEALTH 1 /* driver health counters and uplink piggyback */
+#endif
+
+#ifndef SARAN2_FEATURE_TIMELINE
+#define SARAN2_FEATURE_TIMELINE 1 /* per-phase CoAP request latency timeline */
+#endif
+
+#ifndef SARAN2_FEATURE_OPERATOR_PROFILES
+#define SARAN2_FEATURE_OPERATOR_PROFILES 1 /* operator parameter profiles keyed by serving PLMN */
+#endif
+
+#ifndef SARAN2_FEATURE_ADAPTIVE_TIMEOUT
+#define SARAN2_FEATURE_ADAPTIVE_TIMEOUT 1 /* per-command AT timeouts learned from observed latency */
+#endif
+
+#ifndef SARAN2_FEATURE_WARM_STATE
+#define SARAN2_FEATURE_WARM_STATE 1 /* driver state recovery after an MCU-only reset */
+#endif
+
+#ifndef SARAN2_FEATURE_WAKE
+#define SARAN2_FEATURE_WAKE 1 /* wake-up handshake before the first command after sleep */
+#endif
+
+#ifndef SARAN2_FEATURE_RATE_CONTROL
+#define SARAN2_FEATURE_RATE_CONTROL 1 /* APN rate control pacing of CoAP uplinks */
+#endif
+
+#ifndef SARAN2_FEATURE_BACKOFF
+#define SARAN2_FEATURE_BACKOFF (SARAN2_FEATURE_PSM && SARAN2_FEATURE_RADIO) /* attach and uplink back-off after network rejects */
+#endif
+
+#if SARAN2_FEATURE_BACKOFF && !(SARAN2_FEATURE_PSM && SARAN2_FEATURE_RADIO)
+#error "SARAN2_FEATURE_BACKOFF reads +CEREG reports and requires SARAN2_FEATURE_PSM and SARAN2_FEATURE_RADIO"
+#endif
+
+#ifndef SARAN2_FEATURE_SURVEY
+#define SARAN2_FEATURE_SURVEY 1 /* AT+NUESTATS="RADIO" coverage survey samples */
+#endif
+
+#ifndef SARAN2_FEATURE_COAP_METHODS
+#define SARAN2_FEATURE_COAP_METHODS 1 /* CoAP FETCH, PATCH and iPATCH over a UDP socket */
+#endif
 
 /** Module-specific #defines
  */
 #define NUMBER_OF_PROFILES 3 
 
+/** Default AT response timeout and CoAP response timeout, in milliseconds,
+ *  used until an operator profile says otherwise
+ */
+#define SARAN2_AT_TIMEOUT_MS 500
+#define SARAN2_COAP_TIMEOUT_MS 20000
+
+/** Number of entries in the operator profile table
+ */
+#define SARAN2_OPERATOR_PROFILES 8
+
+/** Built-in operator profile, in effect until a profile is applied and
+ *  whenever the serving network matches none
+ */
+#define SARAN2_DEFAULT_OPERATOR_PROFILE { 0, 0, SARAN2_AT_TIMEOUT_MS, SARAN2_COAP_TIMEOUT_MS, 512, \
+                                          TRANSPORT_COAP, false, "", "" }
+
+/** Adaptive AT command timeouts. Once a command has SARAN2_ADAPTIVE_SAMPLES
+ *  responses its timeout becomes its p99 response time multiplied by
+ *  SARAN2_ADAPTIVE_MARGIN, within the bounds of the command. The latency
+ *  histogram starts at SARAN2_ADAPTIVE_BUCKET_MS and is halved each time it
+ *  holds SARAN2_ADAPTIVE_WINDOW samples, so that old behaviour fades out
+ */
+#define SARAN2_ADAPTIVE_SAMPLES 8
+#define SARAN2_ADAPTIVE_MARGIN 2
+#define SARAN2_ADAPTIVE_BUCKET_MS 16
+#define SARAN2_ADAPTIVE_WINDOW 256
+
+/** Marker and layout version of a saved WarmState_t
+ */
+#define SARAN2_WARM_MAGIC 0x5341524EUL
+#define SARAN2_WARM_VERSION 2
+
+/** Wake-up handshake. The module is treated as possibly asleep when VINT
+ *  is low or nothing has been sent for SARAN2_WAKE_IDLE_MS, and is then 
+ *  woken with up to SARAN2_WAKE_ATTEMPTS "AT" commands, each given 
+ *  SARAN2_WAKE_ATTEMPT_MS to respond, before the real command is sent
+ */
+#define SARAN2_WAKE_IDLE_MS 10000
+#define SARAN2_WAKE_ATTEMPTS 10
+#define SARAN2_WAKE_ATTEMPT_MS 50
+
+/** Back-off after a registration reject, doubling from SARAN2_BACKOFF_BASE_MS
+ *  with each consecutive reject up to SARAN2_BACKOFF_MAX_MS. Congestion 
+ *  (EMM cause 22) starts from SARAN2_BACKOFF_CONGESTION_MS, and up to 
+ *  SARAN2_BACKOFF_JITTER percent is added so that rejected devices do not 
+ *  retry together
+ */
+#define SARAN2_BACKOFF_BASE_MS 60000
+#define SARAN2_BACKOFF_CONGESTION_MS 900000
+#define SARAN2_BACKOFF_MAX_MS 3600000
+#define SARAN2_BACKOFF_JITTER 25
+#define SARAN2_EMM_CAUSE_CONGESTION 22
+
+/** Stack size of the thread that performs asynchronous module start-up
+ */
+#define SARAN2_BOOT_STACK_SIZE 1536
+
+/** Maximum time, in milliseconds, to wait for the module to become ready
+ *  after power-up or reset
+ */
+#define SARAN2_BOOT_TIMEOUT_MS 10000
+
+/** Time, in milliseconds, for which RESET_N is held low to reset the
+ *  module at start-up
+ */
+#define SARAN2_RESET_PULSE_MS 100
+
+/** Event flag set once asynchronous module start-up has completed
+ */
+#define SARAN2_BOOT_DONE_FLAG 0x01
+
+/** Default tolerance of the MCU millisecond clock, in parts per million,
+ *  used to estimate the error of extrapolated network time
+ */
+#define SARAN2_CLOCK_DRIFT_PPM 50
+
+/** Size of the buffer into which single response lines are read, large
+ *  enough for a maximum-size +UCOAPCD payload line
+ */
+#define SARAN2_LINE_BUFFER_SIZE 560
+
+/** Maximum size of a CoAP payload returned by the module
+ */
+#define SARAN2_MAX_COAP_PAYLOAD 512
+
+/** CoAP over a module UDP socket, used for the methods AT+UCOAPC lacks.
+ *  The first SARAN2_COAP_SOCKET_READ bytes of a response are kept, which
+ *  as hex fits SARAN2_LINE_BUFFER_SIZE, and any remainder is drained from
+ *  the module SARAN2_COAP_SOCKET_DRAIN bytes at a time into the rest of 
+ *  the buffer. AT+NSOST sends at most SARAN2_COAP_SOCKET_MAX_DATAGRAM 
+ *  bytes. If the local port is still bound, the next of 
+ *  SARAN2_COAP_SOCKET_PORTS consecutive ports is tried
+ */
+#define SARAN2_COAP_SOCKET_LOCAL_PORT 56830
+#define SARAN2_COAP_SOCKET_READ 256
+#define SARAN2_COAP_SOCKET_DRAIN 96
+#define SARAN2_COAP_SOCKET_MAX_DATAGRAM 512
+#define SARAN2_COAP_SOCKET_PORTS 4
+#define SARAN2_COAP_PATH_SIZE 64
+#define SARAN2_COAP_HEADER_SIZE 96
+
+/** Number of values returned by AT+NUESTATS, see Nuestats_t
+ */
+#define SARAN2_NUESTATS_PARAMETERS 11
+
+/** Upper bound, in bytes, on the local variables of any single driver 
+ *  function. Large working buffers live in the SaraN2 object instead, so a
+ *  thread's stack must cover this budget for every nested call level plus
+ *  ATCmdParser and any application callbacks
+ */
+#define SARAN2_STACK_BUDGET 256
+
+/** Number of logarithmic latency histogram buckets. Bucket 0 holds
+ *  durations shorter than SARAN2_LATENCY_BUCKET_MS and each subsequent 
+ *  bucket doubles the upper bound
+ */
+#define SARAN2_LATENCY_BUCKETS 12
+#define SARAN2_LATENCY_BUCKET_MS 64
+
+/** Value of a CoapTimeline_t event that was not observed
+ */
+#define SARAN2_TIMELINE_NOT_SEEN 0xFFFFFFFF
+
+/** Maximum size of an encoded health record, including its trailer
+ */
+#define SARAN2_HEALTH_RECORD_SIZE 60
+
+/** Version of the health record encoding, and the byte that marks the end
+ *  of a health record appended to a coap_post payload
+ */
+#define SARAN2_HEALTH_VERSION 1
+#define SARAN2_HEALTH_MAGIC 0xB7
+
+/** Set to 1 to encode and decode hex four bytes at a time using 32-bit SWAR
+ *  arithmetic, or 0 to use the lookup table implementation only
+ */
+#ifndef SARAN2_HEX_SWAR
+#define SARAN2_HEX_SWAR 1
+#endif
+
+/** Number of firmware package bytes sent to the module per AT+NFWUPD segment
+ */
+#define SARAN2_FOTA_SEGMENT_SIZE 256
+
+/** Number of attempts made to deliver each firmware package segment
+ */
+#define SARAN2_FOTA_SEGMENT_RETRIES 3
+
+/** Maximum time, in milliseconds, that the module may take to apply a firmware 
+ *  update and become responsive again
+ */
+#define SARAN2_FOTA_APPLY_TIMEOUT_MS 300000
+
 /** Base class for the SaraN2xx series of NB-IoT modules
  */ 
 class SaraN2
@@ -74,7 +313,69 @@ class SaraN2
 			FAIL_SET_NPSMR_TRUE             = 43,
 			FAIL_GET_NPSMR                  = 44,
 			FAIL_SET_CEREG_0                = 45,
-			FAIL_GET_RADIO_STATUS           = 46
+			FAIL_GET_RADIO_STATUS           = 46,
+			FAIL_BOOT                       = 47,
+			FAIL_BOOT_TIMEOUT               = 48,
+			BOOT_IN_PROGRESS                = 49,
+			FAIL_GET_NETWORK_TIME           = 50,
+			TIME_NOT_SYNCHRONISED           = 51,
+			FAIL_SET_CTZR                   = 52,
+			FAIL_RAW_COMMAND                = 53,
+			RAW_COMMAND_ERROR               = 54,
+			FAIL_FOTA_ERASE                 = 55,
+			FAIL_FOTA_READ                  = 56,
+			FAIL_FOTA_SEGMENT               = 57,
+			FAIL_FOTA_VALIDATE              = 58,
+			FAIL_FOTA_APPLY                 = 59,
+			FAIL_GET_STACK_HEADROOM         = 60,
+			HEALTH_BUFFER_TOO_SMALL         = 61,
+			FAIL_GET_GRANTED_PSM            = 62,
+			FAIL_ENABLE_TIMELINE            = 63,
+			FAIL_DISABLE_TIMELINE           = 64,
+			INVALID_TIMELINE_PHASE          = 65,
+			FAIL_GET_PLMN                   = 66,
+			OPERATOR_TABLE_FULL             = 67,
+			FAIL_APPLY_OPERATOR_PROFILE     = 68,
+			INVALID_COMMAND                 = 69,
+			FAIL_GET_IMEI                   = 70,
+			WARM_STATE_INVALID              = 71,
+			WARM_STATE_MISMATCH             = 72,
+			FAIL_GET_RATE_CONTROL           = 73,
+			UPLINK_RATE_LIMITED             = 74,
+			FAIL_BACKOFF_ACTIVE             = 75,
+			FAIL_GET_SURVEY_SAMPLE          = 76,
+			COAP_PATH_TOO_LONG              = 77,
+			FAIL_OPEN_COAP_SOCKET           = 78,
+			FAIL_START_FETCH_REQUEST        = 79,
+			FAIL_START_PATCH_REQUEST        = 80,
+			FAIL_START_IPATCH_REQUEST       = 81,
+			COAP_REQUEST_TOO_LARGE          = 82,
+			COAP_RESPONSE_TRUNCATED         = 83,
+			COAP_RESET_RECEIVED             = 84,
+			INVALID_COAP_ADDRESS            = 85
+		};
+
+		/** AT commands whose timeouts are tracked individually
+		 */
+		enum
+		{
+			COMMAND_AT         = 0,
+			COMMAND_CSQ        = 1,
+			COMMAND_CEREG      = 2,
+			COMMAND_CFUN       = 3,
+			COMMAND_CGATT      = 4,
+			COMMAND_COPS       = 5,
+			COMMAND_UCOAP_SAVE = 6,
+			COMMAND_COUNT      = 7
+		};
+
+		/** Preferred uplink transports of an operator profile
+		 */
+		enum
+		{
+			TRANSPORT_COAP = 0,
+			TRANSPORT_UDP  = 1,
+			TRANSPORT_NIDD = 2
 		};
 
         /** CoAP response codes 
@@ -87,6 +388,19 @@ class SaraN2
             SERVER_ERROR  = 5
         };
 
+		/** CoAP Content-Format numbers used by the socket path, i.e. for
+		 *  coap_fetch(), coap_patch() and coap_ipatch()
+		 */
+		enum
+		{
+			COAP_FORMAT_TEXT_PLAIN       = 0,
+			COAP_FORMAT_OCTET_STREAM     = 42,
+			COAP_FORMAT_JSON             = 50,
+			COAP_FORMAT_JSON_PATCH       = 51,
+			COAP_FORMAT_MERGE_PATCH_JSON = 52,
+			COAP_FORMAT_CBOR             = 60
+		};
+
 		/** List of available CoAP profiles
 		 */ 
 		enum
@@ -184,6 +498,125 @@ class SaraN2
             char data[44];
         };
 
+		/** Transfer statistics of a firmware package download
+		 */
+		struct FirmwareUpdateStats_t
+		{
+			uint32_t bytes;         
+			uint16_t segments;      
+			uint16_t retries;       
+			uint32_t elapsed_ms;    
+			uint32_t bytes_per_sec; 
+		};
+
+		/** Driver health counters, accumulated since construction or the last
+		 *  call to reset_health()
+		 */
+		struct Health_t
+		{
+			uint32_t coap_requests;   
+			uint32_t coap_failures;   
+			uint32_t timeouts;        
+			uint32_t retries;         
+			uint32_t reboots;         
+			uint32_t attaches;        
+			uint32_t last_attach_ms;  
+			uint32_t psm_wakes;       
+			uint32_t coap_latency[SARAN2_LATENCY_BUCKETS];
+		};
+
+		/** Timeline of a single CoAP request. Each event is the time in 
+		 *  milliseconds from the start of the AT command write, or 
+		 *  SARAN2_TIMELINE_NOT_SEEN if the event was not observed
+		 */
+		struct CoapTimeline_t
+		{
+			uint32_t write_end;  /* command handed to the UART */
+			uint32_t accepted;   /* OK */
+			uint32_t connected;  /* +CSCON: 1, RRC connection set up */
+			uint32_t response;   /* +UCOAPCD */
+			uint32_t parsed;     /* response payload parsed */
+			uint32_t released;   /* +CSCON: 0, RRC connection released */
+			int      status;     /* return code of the request */
+		};
+
+		/** Parameters tuned for one operator, selected by the MCC and MNC of
+		 *  the serving network. A profile with an MCC of 0 matches any network
+		 *  that has no profile of its own
+		 */
+		struct OperatorProfile_t
+		{
+			uint16_t mcc;
+			uint16_t mnc;
+			uint32_t at_timeout_ms;   
+			uint32_t coap_timeout_ms; 
+			uint16_t block_size;      /* preferred CoAP block size in bytes */
+			uint8_t  transport;       /* enumerated TRANSPORT_x value */
+			bool     request_psm;     /* request t3412 and t3324 with AT+CPSMS */
+			char     t3412[9];        
+			char     t3324[9];        
+		};
+
+		/** Driver state saved before an MCU-only reset, i.e. in retained RAM
+		 *  or flash, and restored afterwards while the module keeps running.
+		 *  The stamp is a CRC-32 of every preceding byte
+		 */
+		struct WarmState_t
+		{
+			uint32_t magic;
+			uint16_t version;
+			uint16_t length;
+			char     imei[16];
+			int8_t   coap_profile;        /* -1 if none was selected */
+			int8_t   coap_socket;         /* CoAP socket path socket, -1 if none */
+			uint8_t  nconfig_mask;        /* AT+NCONFIG functions set */
+			uint8_t  nconfig_values;      /* and the value each was set to */
+			uint8_t  requested_psm;
+			char     t3412[9];
+			char     t3324[9];
+			int8_t   registration_status;
+			uint32_t cell_id;
+			OperatorProfile_t operator_profile;
+			uint32_t stamp;
+		};
+
+		/** Wake-up handshake statistics
+		 */
+		struct WakeStats_t
+		{
+			uint32_t wakes;     /* handshakes performed */
+			uint32_t failures;  /* handshakes that got no response */
+			uint32_t last_ms;   /* wake-to-ready time of the last handshake */
+			uint32_t max_ms;    /* longest wake-to-ready time */
+		};
+
+		/** APN rate control allowance. max_rate uplinks are allowed per
+		 *  unit_ms, and are paced with a token bucket of that size
+		 */
+		struct UplinkAllowance_t
+		{
+			uint32_t max_rate;          /* uplinks per unit, 0 if unrestricted */
+			uint32_t unit_ms;           /* rate control period */
+			uint32_t available;         /* uplinks that can be sent now */
+			uint32_t next_ms;           /* time until another uplink is allowed */
+			uint32_t deferred;          /* uplinks refused with UPLINK_RATE_LIMITED */
+			bool     exception_reports; /* exception reports allowed beyond the limit */
+		};
+
+		/** Phases of a CoapTimeline_t aggregated by get_coap_phase_percentile()
+		 */
+		enum
+		{
+			PHASE_WRITE      = 0, /* write start to write end */
+			PHASE_ACCEPT     = 1, /* write end to OK */
+			PHASE_CONNECT    = 2, /* OK to RRC connection set up */
+			PHASE_ROUND_TRIP = 3, /* RRC connection, or OK, to +UCOAPCD */
+			PHASE_PARSE      = 4, /* +UCOAPCD to parse end */
+			PHASE_RELEASE    = 5, /* parse end to RRC connection release */
+			PHASE_TOTAL      = 6, /* write start to parse end */
+			PHASE_COUNT      = 7
+		};
+
 		/** Constructor for the SaraN2 class. Instantiates an ATCmdParser object
 		 *  on the heap for comms between microcontroller and modem
 		 * 
@@ -203,6 +636,43 @@ class SaraN2
 		 */  
 		~SaraN2();
 
+#if SARAN2_FEATURE_ASYNC_BOOT
+		/** Start the module asynchronously. A start-up thread resets the
+		 *  module with RESET_N, unless a warm state is given, waits for VINT
+		 *  to go high, then probes the module with "AT" until it responds
+		 *  (skipping over the "u-blox" power-on banner), and finally runs the
+		 *  optional configuration callback. This function returns immediately
+		 *  so that the rest of the system can initialise in parallel
+		 *
+		 * @param ready_cb Optional callback invoked from the start-up thread
+		 *                 with the final start-up status
+		 * @param configure Optional callback invoked once the module responds,
+		 *                  i.e. to select and load a CoAP profile. A non-zero
+		 *                  return value is reported as the start-up status
+		 * @param *warm_state Optional state saved before an MCU-only reset.
+		 *                    If restore_warm_state() accepts it the module
+		 *                    is already configured and configure is skipped
+		 * @return Indicates success or failure reason
+		 */
+		int begin(Callback<void(int)> ready_cb = nullptr, Callback<int()> configure = nullptr,
+		          const WarmState_t *warm_state = nullptr);
+
+		/** Block until asynchronous start-up, started with begin(), completes
+		 *
+		 * @param timeout_ms Maximum time to wait in milliseconds
+		 * @return Start-up status, FAIL_BOOT_TIMEOUT if start-up did not 
+		 *         complete in time or FAIL_BOOT if begin() was not called
+		 */
+		int wait_ready(uint32_t timeout_ms = SARAN2_BOOT_TIMEOUT_MS);
+
+		/** Non-blocking check of asynchronous start-up status
+		 *
+		 * @return SARAN2_OK if the module is ready, BOOT_IN_PROGRESS if 
+		 *         start-up is still running, otherwise failure reason
+		 */
+		int is_ready();
+#endif /* SARAN2_FEATURE_ASYNC_BOOT */
+
 		/** Send "AT" command
          *
          * @return Indicates success or failure 
@@ -219,6 +689,7 @@ class SaraN2
 		 */
         int csq(int &power, int &quality);
 
+#if SARAN2_FEATURE_PSM
 		/** Retrieve current module PSM status
 		 * 
 		 * @param &psm Address of integer where PSM
@@ -226,7 +697,9 @@ class SaraN2
 		 * @return Indicates success or failure reason
 		 */
 		int npsmr(int &psm);
+#endif /* SARAN2_FEATURE_PSM */
 
+#if SARAN2_FEATURE_COAP_PROFILES
 		/** Select CoAP profile number, between 0-3
          *
 		 * @param profile Use enumerated values COAP_PROFILE_x to select profile
@@ -335,7 +808,9 @@ class SaraN2
 		 * @return Indicates success or failure reason
 		 */  
 		int select_coap_at_interface();
+#endif /* SARAN2_FEATURE_COAP_PROFILES */
 
+#if SARAN2_FEATURE_COAP
 		/** Parse response from CoAP server into recv_data
          * 
          * @param *recv_data Pointer to a byte array where the data
@@ -344,10 +819,30 @@ class SaraN2
          *                       will be stored
          * @param &more_block Address of integer where data more_block response
          *                    will be stored
-         * @param timeout_ms Timeout value for the parser in milliseconds
+         * @param timeout_ms Timeout value for the parser in milliseconds, 0 
+         *                   uses the CoAP timeout of the operator profile
          * @return Indicates success or failure reason
          */
-		int parse_coap_response(char *recv_data, int &response_code, int &more_block, uint16_t timeout_ms = 20000);
+		int parse_coap_response(char *recv_data, int &response_code, int &more_block, uint16_t timeout_ms = 0);
+
+		/** Parse response from CoAP server, decoding the hex payload on the 
+		 *  AT interface with hex_decode() into binary data in recv_data
+		 *
+		 * @param *recv_data Pointer to a byte array of SARAN2_MAX_COAP_PAYLOAD
+		 *                   bytes in which to store the decoded payload
+		 * @param &recv_length Address of integer in which to store the
+		 *                     decoded payload length
+		 * @param &response_code Address of integer where CoAP operation response code
+		 *                       will be stored
+		 * @param &more_block Address of integer where data more_block response
+		 *                    will be stored
+		 * @param timeout_ms Timeout value for the parser in milliseconds, 0 
+		 *                   uses the CoAP timeout of the operator profile
+		 * @return Indicates success or failure reason. FAIL_PARSE_RESPONSE if
+		 *         no response arrived or the payload is not valid hex
+		 */
+		int parse_coap_response(uint8_t *recv_data, size_t &recv_length, int &response_code, int &more_block, 
+		                        uint16_t timeout_ms = 0);
 
 		/** Perform a GET request using CoAP and save the returned 
 		 *  data into recv_data
@@ -402,6 +897,85 @@ class SaraN2
 		 * @return Indicates success or failure reason
 		 */ 
 		int coap_post(uint8_t* send_data,size_t buffer_len, char *recv_data, int data_indentifier, uint8_t send_block_number, uint8_t send_more_block, int &response_code);
+#endif /* SARAN2_FEATURE_COAP */
+
+#if SARAN2_FEATURE_COAP_METHODS
+		/** Set the server and resource used by coap_fetch(), coap_patch() and
+		 *  coap_ipatch(). AT+UCOAPC only supports GET, DELETE, PUT and POST,
+		 *  so these methods are sent as CoAP messages on a module UDP socket
+		 *  and do not use the CoAP profile
+		 *
+		 * @param *ipv4 Pointer to the server IPv4 address string
+		 * @param port Server port, normally 5683
+		 * @param *path Pointer to the resource path, i.e. "state/device"
+		 * @return Indicates success or failure reason. INVALID_COAP_ADDRESS
+		 *         if ipv4 is not a dotted-quad IPv4 address
+		 */
+		int set_coap_socket_target(const char *ipv4, uint16_t port, const char *path);
+
+		/** Perform a FETCH request (RFC 8132), returning only the parts of 
+		 *  the resource selected by the request body
+		 *
+		 * @param *send_data Pointer to the request body, i.e. a query
+		 * @param length Number of bytes in the request body
+		 * @param content_format CoAP Content-Format of the body, i.e.
+		 *                       COAP_FORMAT_JSON
+		 * @param *recv_data Pointer to a byte array of SARAN2_MAX_COAP_PAYLOAD
+		 *                   bytes in which to store the response payload
+		 * @param &recv_length Address of integer in which to store the
+		 *                     response payload length
+		 * @param &response_code Address of integer where the CoAP response 
+		 *                       class will be stored, i.e. SUCCESS
+		 * @return Indicates success or failure reason. COAP_RESPONSE_TRUNCATED
+		 *         if only the first SARAN2_COAP_SOCKET_READ bytes of the 
+		 *         response were kept, COAP_RESET_RECEIVED if the server 
+		 *         rejected the request with a RST
+		 */
+		int coap_fetch(const uint8_t *send_data, size_t length, uint16_t content_format, 
+		               uint8_t *recv_data, size_t &recv_length, int &response_code);
+
+		/** Perform a PATCH request (RFC 8132), applying the changes in the
+		 *  request body to the resource. PATCH is not idempotent
+		 *
+		 * @param *send_data Pointer to the request body, i.e. a JSON patch
+		 * @param length Number of bytes in the request body
+		 * @param content_format CoAP Content-Format of the body, i.e.
+		 *                       COAP_FORMAT_JSON_PATCH
+		 * @param *recv_data Pointer to a byte array of SARAN2_MAX_COAP_PAYLOAD
+		 *                   bytes in which to store the response payload
+		 * @param &recv_length Address of integer in which to store the
+		 *                     response payload length
+		 * @param &response_code Address of integer where the CoAP response 
+		 *                       class will be stored, i.e. SUCCESS
+		 * @return Indicates success or failure reason. COAP_RESPONSE_TRUNCATED
+		 *         if only the first SARAN2_COAP_SOCKET_READ bytes of the 
+		 *         response were kept, COAP_RESET_RECEIVED if the server 
+		 *         rejected the request with a RST
+		 */
+		int coap_patch(const uint8_t *send_data, size_t length, uint16_t content_format, 
+		               uint8_t *recv_data, size_t &recv_length, int &response_code);
+
+		/** Perform an iPATCH request (RFC 8132), the idempotent form of
+		 *  PATCH, i.e. with a merge patch that sets fields to new values
+		 *
+		 * @param *send_data Pointer to the request body
+		 * @param length Number of bytes in the request body
+		 * @param content_format CoAP Content-Format of the body, i.e.
+		 *                       COAP_FORMAT_MERGE_PATCH_JSON
+		 * @param *recv_data Pointer to a byte array of SARAN2_MAX_COAP_PAYLOAD
+		 *                   bytes in which to store the response payload
+		 * @param &recv_length Address of integer in which to store the
+		 *                     response payload length
+		 * @param &response_code Address of integer where the CoAP response 
+		 *                       class will be stored, i.e. SUCCESS
+		 * @return Indicates success or failure reason. COAP_RESPONSE_TRUNCATED
+		 *         if only the first SARAN2_COAP_SOCKET_READ bytes of the 
+		 *         response were kept, COAP_RESET_RECEIVED if the server 
+		 *         rejected the request with a RST
+		 */
+		int coap_ipatch(const uint8_t *send_data, size_t length, uint16_t content_format, 
+		                uint8_t *recv_data, size_t &recv_length, int &response_code);
+#endif /* SARAN2_FEATURE_COAP_METHODS */
 
 		/** Reboots the module. After receiving the 'REBOOTING' response, no further
 		 *  AT commands will be processed until the module has successfully power on
@@ -410,6 +984,7 @@ class SaraN2
 		 */
 		int reboot_module();
 
+#if SARAN2_FEATURE_PSM
 		/** Enable module Power Save Mode (PSM)
 		 * 
 		 * @return Indicates success or failure reason
@@ -434,7 +1009,7 @@ class SaraN2
 
 		/** Set the T3412 timer. The AT command requires that the PSM and
 		 *  T3324 settings are specified also, so the current values for 
-		 *  these settings are determined and reused
+		 *  these settings are determined and reused within the same lock
 		 * 
 		 * @param *timer Char array containing 8-bit binary string conforming
 		 *               to 3GPP TS 24.008 GPRS Timer 3 definition
@@ -453,7 +1028,7 @@ class SaraN2
 
 		/** Set the T3324 timer. The AT command requires that the PSM and
 		 *  T3412 settings are specified also, so the current values for 
-		 *  these settings are determined and reused
+		 *  these settings are determined and reused within the same lock
 		 * 
 		 * @param *timer Char array containing 8-bit binary string conforming
 		 *               to 3GPP TS 24.008 GPRS Timer 2 definition
@@ -470,6 +1045,59 @@ class SaraN2
 		 */
 		int get_t3324_timer(char *timer);
 
+		/** Read the PSM timers granted by the network from a +CEREG level 4
+		 *  report. The network may grant different values to those requested
+		 *  or refuse PSM altogether, in which case granted is set to 0
+		 *
+		 * @param *active_time Pointer to Char array of at least 9 bytes in which
+		 *                     to store the granted T3324 binary string, empty if
+		 *                     none was granted
+		 * @param *periodic_tau Pointer to Char array of at least 9 bytes in which 
+		 *                      to store the granted T3412 binary string, empty if 
+		 *                      none was granted
+		 * @param &granted Address of integer in which to store 1 if PSM was 
+		 *                 granted, otherwise 0
+		 * @return Indicates success or failure reason
+		 */
+		int get_granted_psm_timers(char *active_time, char *periodic_tau, int &granted);
+
+		/** Retrieve the PSM setting and timers last requested through this 
+		 *  driver. This does not communicate with the module
+		 *
+		 * @param *t3324 Pointer to Char array of at least 9 bytes in which to
+		 *               store the requested T3324 binary string
+		 * @param *t3412 Pointer to Char array of at least 9 bytes in which to
+		 *               store the requested T3412 binary string
+		 * @param &enabled Address of integer in which to store 1 if PSM was
+		 *                 requested, otherwise 0
+		 */
+		void get_requested_psm_timers(char *t3324, char *t3412, int &enabled);
+
+		/** When enabled and the network has not granted PSM, according to the 
+		 *  last get_granted_psm_timers(), begin_uplink_burst() and 
+		 *  end_uplink_burst() power the RF circuitry up and down around 
+		 *  uplinks so that idle current stays close to that of PSM
+		 *
+		 * @param enable True to enable CFUN duty-cycling, false to disable
+		 */
+		void set_psm_fallback(bool enable);
+
+		/** Call before a burst of uplinks. Activates the radio if the PSM 
+		 *  fallback is in effect, otherwise does nothing
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int begin_uplink_burst();
+
+		/** Call after a burst of uplinks. Deactivates the radio if the PSM
+		 *  fallback is in effect, otherwise does nothing
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int end_uplink_burst();
+#endif /* SARAN2_FEATURE_PSM */
+
+#if SARAN2_FEATURE_NCONFIG
 		/** Configure customisable aspects of the UE given the functions and values
 		 *  available in the enumerated list of AT+NCONFIG functions and values
 		 * 
@@ -478,7 +1106,9 @@ class SaraN2
 		 * @return Indicates success or failure reason 
 		 */ 
 		int configure_ue(uint8_t function, uint8_t value);
+#endif /* SARAN2_FEATURE_NCONFIG */
 
+#if SARAN2_FEATURE_RADIO
         /** Determine whether +CEREG URC is enabled and the current
          *  network registration status of the device
          *
@@ -497,7 +1127,9 @@ class SaraN2
          * @return Indicates success or failure reason
          */
         int cscon(int &urc, int &connected);
+#endif /* SARAN2_FEATURE_RADIO */
 
+#if SARAN2_FEATURE_STATS
 		/** Return operation stats, of a given type, of the module
          * 
          * @param *data Point to .data parameter of Nuestats_t struct
@@ -505,7 +1137,23 @@ class SaraN2
          * @return Indicates success or failure reason
          */
 		int nuestats(char *data);
+#endif /* SARAN2_FEATURE_STATS */
+
+#if SARAN2_FEATURE_SURVEY
+		/** Read the serving cell radio measurements for a coverage survey 
+		 *  with a single AT+NUESTATS="RADIO". Returns as soon as the final
+		 *  OK arrives, so it can be called at the module's reporting rate.
+		 *  The position fields are left for the application to fill in
+		 *  before the sample is appended to a SaraN2SurveyLog
+		 *
+		 * @param &sample Address of SaraN2SurveyLog::Sample_t in which to 
+		 *                store the measurements and timestamp
+		 * @return Indicates success or failure reason
+		 */
+		int survey_sample(SaraN2SurveyLog::Sample_t &sample);
+#endif /* SARAN2_FEATURE_SURVEY */
 
+#if SARAN2_FEATURE_RADIO
 		/** Is the TX/RX circuitry turned on or off? 1 is on, 0 is off
 		 * 
 		 * @param &status Address of integer value to which to return the status
@@ -550,10 +1198,356 @@ class SaraN2
 		 * @return Indicates success or failure reason
 		 */
         int deregister_from_network();
+#endif /* SARAN2_FEATURE_RADIO */
+
+#if SARAN2_FEATURE_TIME
+		/** Read network time once with AT+CCLK? and cache it against the
+		 *  MCU's monotonic millisecond clock. Call once per wake, all further
+		 *  timestamps are extrapolated by get_timestamp() with no AT traffic.
+		 *  The cache is also refreshed by +CTZV/+CTZEU NITZ URCs
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int sync_network_time();
+
+		/** Enable or disable time zone change reporting (NITZ URCs). When
+		 *  enabled, network time updates refresh the cached network time
+		 *  whenever the URC is received during any other command
+		 *
+		 * @param enable True to enable +CTZV reporting, false to disable
+		 * @return Indicates success or failure reason
+		 */
+		int set_time_zone_reporting(bool enable);
+
+		/** Get the current UTC time extrapolated from the last network time
+		 *  sync. This does not communicate with the module
+		 *
+		 * @param &epoch_ms Address of integer in which to store milliseconds
+		 *                  since the Unix epoch
+		 * @param &error_ms Address of integer in which to store the estimated
+		 *                  worst-case error of epoch_ms in milliseconds
+		 * @return Indicates success or failure reason
+		 */
+		int get_timestamp(uint64_t &epoch_ms, uint32_t &error_ms);
+
+		/** Get the time zone reported alongside the last network time sync
+		 *
+		 * @param &quarter_hours Address of integer in which to store the
+		 *                       offset from UTC in quarters of an hour
+		 * @return Indicates success or failure reason
+		 */
+		int get_time_zone(int &quarter_hours);
+
+		/** Set the tolerance of the MCU clock used to estimate timestamp error
+		 *
+		 * @param ppm Clock tolerance in parts per million
+		 */
+		void set_clock_drift_ppm(uint16_t ppm);
+#endif /* SARAN2_FEATURE_TIME */
+
+		/** Send an AT command that the driver does not wrap, i.e. AT+CGDCONT?,
+		 *  while holding the driver lock. Every intermediate response line is
+		 *  passed to line_cb until the final result code is received
+		 *
+		 * @param *command Null-terminated command string, without CR LF
+		 * @param line_cb Optional callback receiving a pointer to and length of
+		 *                each response line. The pointer refers to the driver's
+		 *                line buffer and is only valid for the duration of the call
+		 * @param timeout_ms Maximum time to wait for each response line
+		 * @return SARAN2_OK on "OK", RAW_COMMAND_ERROR on "ERROR" or 
+		 *         "+CME ERROR", FAIL_RAW_COMMAND on timeout
+		 */
+		int raw_command(const char *command, Callback<void(const char *, int)> line_cb = nullptr, 
+		                uint32_t timeout_ms = 500);
+
+#if SARAN2_FEATURE_FOTA
+		/** Stream a firmware delta package into the module with AT+NFWUPD. The 
+		 *  package is read in SARAN2_FOTA_SEGMENT_SIZE chunks through read_cb, 
+		 *  i.e. from MCU flash, and each hex-encoded segment is checksummed and 
+		 *  retried until the module accepts it. When all segments have been 
+		 *  delivered the package is validated by the module
+		 *
+		 * @param size Total size of the package in bytes
+		 * @param read_cb Callback that copies length bytes of the package, starting
+		 *                at offset, into the supplied buffer. Must return 0 on success
+		 * @param &next_segment Address of integer holding the segment number to start
+		 *                      from. Pass 0 to erase any previous package and start
+		 *                      afresh. On return it holds the next segment to send, 
+		 *                      so a failed transfer can be resumed
+		 * @param *stats Optional pointer to a FirmwareUpdateStats_t in which to store
+		 *               transfer statistics
+		 * @return Indicates success or failure reason
+		 */
+		int download_firmware_package(uint32_t size, Callback<int(uint32_t, uint8_t *, uint32_t)> read_cb,
+		                              uint16_t &next_segment, FirmwareUpdateStats_t *stats = NULL);
+
+		/** Apply a previously downloaded and validated firmware package. The 
+		 *  module reboots to install the update, and this function blocks until 
+		 *  it responds to "AT" again
+		 *
+		 * @param &downtime_ms Address of integer in which to store the time for 
+		 *                     which the module was unavailable
+		 * @return Indicates success or failure reason
+		 */
+		int apply_firmware_package(uint32_t &downtime_ms);
+#endif /* SARAN2_FEATURE_FOTA */
+
+		/** Encode binary data as lower-case hex, as used for payloads on the
+		 *  AT interface. No terminator is written
+		 *
+		 * @param *data Pointer to the data to encode
+		 * @param length Number of bytes to encode
+		 * @param *hex Pointer to a byte array of at least 2 * length bytes
+		 * @return Number of characters written
+		 */
+		static size_t hex_encode(const uint8_t *data, size_t length, char *hex);
+
+		/** Decode upper- or lower-case hex, i.e. a payload received into 
+		 *  recv_data, into binary data
+		 *
+		 * @param *hex Pointer to the characters to decode
+		 * @param length Number of characters to decode, must be even
+		 * @param *data Pointer to a byte array of at least length / 2 bytes
+		 * @return Number of bytes written, or -1 if the input is not valid hex
+		 */
+		static int hex_decode(const char *hex, size_t length, uint8_t *data);
+
+		/** Report how much of the calling thread's stack has never been used.
+		 *  Requires the RTOS stack watermark to be enabled, i.e. by setting
+		 *  MBED_STACK_STATS_ENABLED, otherwise 0 is reported
+		 *
+		 * @param &free_bytes Address of integer in which to store the number 
+		 *                    of stack bytes that have never been used
+		 * @return Indicates success or failure reason
+		 */
+		int get_stack_headroom(uint32_t &free_bytes);
+
+#if SARAN2_FEATURE_HEALTH
+		/** Copy the current driver health counters
+		 *
+		 * @param &health Address of Health_t in which to store the counters
+		 */
+		void get_health(Health_t &health);
+
+		/** Clear all driver health counters
+		 */
+		void reset_health();
+
+		/** Encode the driver health counters into a compact binary record. The
+		 *  record is a version byte, the Health_t counters and the p50, p90 and
+		 *  p99 CoAP latency in milliseconds as unsigned LEB128 varints, followed
+		 *  by a trailer of the record length and SARAN2_HEALTH_MAGIC
+		 *
+		 * @param *buffer Pointer to a byte array in which to store the record
+		 * @param size Size of buffer, SARAN2_HEALTH_RECORD_SIZE is always enough
+		 * @param &length Address of integer in which to store the record length
+		 * @return Indicates success or failure reason
+		 */
+		int encode_health_record(uint8_t *buffer, size_t size, size_t &length);
+
+		/** Append the health record to the payload of coap_post at most once 
+		 *  per interval. The server recognises the record by the trailing 
+		 *  SARAN2_HEALTH_MAGIC byte and the length byte that precedes it. Only
+		 *  APPLICATION_OCTET payloads carry the record, and only when it still
+		 *  fits within SARAN2_MAX_COAP_PAYLOAD, otherwise it waits for a later post
+		 *
+		 * @param interval_s Minimum interval between piggybacked records in 
+		 *                   seconds, 0 disables piggybacking (the default)
+		 */
+		void set_health_piggyback(uint32_t interval_s);
+#endif /* SARAN2_FEATURE_HEALTH */
+
+#if SARAN2_FEATURE_OPERATOR_PROFILES
+		/** Add a profile to the operator profile table, replacing any profile
+		 *  with the same MCC and MNC. Takes effect at the next call to 
+		 *  apply_operator_profile()
+		 *
+		 * @param &profile Profile to add
+		 * @return Indicates success or failure reason
+		 */
+		int set_operator_profile(const OperatorProfile_t &profile);
+
+		/** Remove every profile from the operator profile table
+		 */
+		void clear_operator_profiles();
+
+		/** Read the MCC and MNC of the serving network with AT+COPS?
+		 *
+		 * @param &mcc Address of integer in which to store the MCC
+		 * @param &mnc Address of integer in which to store the MNC
+		 * @return Indicates success or failure reason
+		 */
+		int get_serving_plmn(uint16_t &mcc, uint16_t &mnc);
+
+		/** Select the profile of the serving network and apply its timeouts
+		 *  and, if it requests PSM, its T3412 and T3324 timers. Networks 
+		 *  without a profile use the MCC 0 profile or the built-in defaults
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int apply_operator_profile();
+
+		/** Apply the operator profile automatically whenever cereg() reports
+		 *  a new registration, home or roaming
+		 *
+		 * @param enable True to apply profiles automatically
+		 */
+		void set_operator_profile_auto(bool enable);
+
+		/** Copy the profile currently in effect, i.e. to read its preferred
+		 *  block size and transport
+		 *
+		 * @param &profile Address of OperatorProfile_t in which to store it
+		 */
+		void get_operator_profile(OperatorProfile_t &profile);
+#endif /* SARAN2_FEATURE_OPERATOR_PROFILES */
+
+#if SARAN2_FEATURE_ADAPTIVE_TIMEOUT
+		/** Read the timeout currently used for a command
+		 *
+		 * @param command Enumerated COMMAND_x value
+		 * @param &timeout_ms Address of integer in which to store the timeout
+		 * @return Indicates success or failure reason
+		 */
+		int get_command_timeout(uint8_t command, uint32_t &timeout_ms);
+
+		/** Forget all observed command latencies and return every command to
+		 *  its seed timeout
+		 */
+		void reset_command_timeouts();
+#endif /* SARAN2_FEATURE_ADAPTIVE_TIMEOUT */
+
+#if SARAN2_FEATURE_WARM_STATE
+		/** Read the module IMEI with AT+CGSN=1
+		 *
+		 * @param *imei Pointer to Char array of at least 16 bytes in which to
+		 *              store the IMEI
+		 * @return Indicates success or failure reason
+		 */
+		int get_imei(char *imei);
+
+		/** Capture the cached module state, i.e. before a planned reset or
+		 *  periodically into retained RAM
+		 *
+		 * @param &state Address of WarmState_t in which to store the state
+		 * @return Indicates success or failure reason
+		 */
+		int save_warm_state(WarmState_t &state);
+
+		/** Adopt state saved by save_warm_state() if its stamp is valid,
+		 *  the module is the one it was saved from, checked with AT+CGSN=1,
+		 *  and it has not rebooted since, checked by a +CEREG report still
+		 *  showing the registration and cell that were saved. State saved
+		 *  while unregistered cannot be checked and is never adopted
+		 *
+		 * @param &state Saved state
+		 * @return SARAN2_OK if the state was adopted, WARM_STATE_INVALID, 
+		 *         WARM_STATE_MISMATCH or FAIL_GET_IMEI
+		 */
+		int restore_warm_state(const WarmState_t &state);
+#endif /* SARAN2_FEATURE_WARM_STATE */
+
+#if SARAN2_FEATURE_WAKE
+		/** Set how long the module may be left without commands before it
+		 *  is treated as possibly asleep. VINT going low always counts
+		 *
+		 * @param idle_ms Idle time in milliseconds, 0 to rely on VINT only
+		 */
+		void set_wake_idle_time(uint32_t idle_ms);
+
+		/** Copy the wake-up handshake statistics
+		 *
+		 * @param &stats Address of WakeStats_t in which to store them
+		 */
+		void get_wake_stats(WakeStats_t &stats);
+#endif /* SARAN2_FEATURE_WAKE */
+
+#if SARAN2_FEATURE_RATE_CONTROL
+		/** Read the APN rate control of the default PDP context with 
+		 *  AT+CGAPNRC and resize the uplink token bucket to match. Called
+		 *  automatically before the first CoAP request after an attach
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int read_apn_rate_control();
+
+		/** Report the current uplink allowance
+		 *
+		 * @param &allowance Address of UplinkAllowance_t in which to store it
+		 */
+		void get_uplink_allowance(UplinkAllowance_t &allowance);
+
+		/** Enable or disable uplink pacing. While enabled, CoAP requests 
+		 *  beyond the APN rate control return UPLINK_RATE_LIMITED without 
+		 *  being sent, so the application can coalesce or defer them
+		 *
+		 * @param enable True to pace uplinks, the default
+		 */
+		void set_uplink_pacing(bool enable);
+#endif /* SARAN2_FEATURE_RATE_CONTROL */
+
+#if SARAN2_FEATURE_BACKOFF
+		/** Report the back-off in force after a registration reject. While
+		 *  it lasts, auto_register_to_network(), gprs_attach() and CoAP
+		 *  requests return FAIL_BACKOFF_ACTIVE without reaching the network
+		 *
+		 * @param &remaining_ms Address of integer in which to store the 
+		 *                      remaining back-off, 0 if none is in force
+		 * @param &reject_cause Address of integer in which to store the EMM
+		 *                      reject cause that started it, -1 if unknown
+		 */
+		void get_backoff(uint32_t &remaining_ms, int &reject_cause);
+
+		/** End any back-off in force and forget consecutive rejects, i.e.
+		 *  after the SIM or subscription has been changed
+		 */
+		void clear_backoff();
+#endif /* SARAN2_FEATURE_BACKOFF */
+
+#if SARAN2_FAULT_INJECTION
+		/** Access the fault injector placed between the UART and the AT
+		 *  command parser, i.e. to schedule faults during a benchmark
+		 *
+		 * @return Pointer to the fault injector
+		 */
+		SaraN2FaultInjector *fault_injector();
+#endif /* SARAN2_FAULT_INJECTION */
+
+#if SARAN2_FEATURE_TIMELINE
+		/** Record a timeline of every CoAP request. Enables the +CSCON URC so 
+		 *  that RRC connection set up and release can be timestamped. A 
+		 *  timeline is complete, and passed to the callback, when the RRC 
+		 *  connection is released or, failing that, when the next CoAP 
+		 *  request starts. The callback runs with the driver lock held and
+		 *  must not call back into the driver
+		 *
+		 * @param timeline_cb Optional callback invoked with each timeline
+		 * @return Indicates success or failure reason
+		 */
+		int enable_coap_timeline(Callback<void(const CoapTimeline_t &)> timeline_cb = nullptr);
+
+		/** Stop recording CoAP request timelines and disable the +CSCON URC
+		 *
+		 * @return Indicates success or failure reason
+		 */
+		int disable_coap_timeline();
+
+		/** Estimate a percentile of the duration of one phase of all CoAP 
+		 *  requests recorded since enable_coap_timeline()
+		 *
+		 * @param phase Enumerated PHASE_x value
+		 * @param percent Percentile to estimate, i.e. 99 for p99
+		 * @param &ms Address of integer in which to store the upper bound of
+		 *            the histogram bucket containing the percentile
+		 * @return Indicates success or failure reason
+		 */
+		int get_coap_phase_percentile(uint8_t phase, uint8_t percent, uint32_t &ms);
+#endif /* SARAN2_FEATURE_TIMELINE */
 
 
 	private:
 
+#if SARAN2_FEATURE_NCONFIG
         /** Potential AT+CONFIG function arguments, to be accessed using the enumerated
 		 *  value that corresponds to the index of the function you wish to use, i.e:
 		 *  config_functions[AUTOCONNECT];
@@ -567,6 +1561,308 @@ class SaraN2
 		 *  config_values[TRUE];
 		 */
 		const char *config_values[2] = { "TRUE", "FALSE" };
+#endif /* SARAN2_FEATURE_NCONFIG */
+
+#if SARAN2_FEATURE_ASYNC_BOOT
+		/** Body of the asynchronous start-up thread created by begin()
+		 */
+		void _boot_task();
+#endif /* SARAN2_FEATURE_ASYNC_BOOT */
+
+#if SARAN2_FEATURE_COAP
+		/** Read a +UCOAPCD response, leaving its hex payload in the line
+		 *  buffer. Must be called with the driver lock held
+		 *
+		 * @param &response_code Address of integer where CoAP operation 
+		 *                       response code will be stored
+		 * @param &more_block Address of integer where data more_block 
+		 *                    response will be stored
+		 * @param timeout_ms Timeout value for the parser in milliseconds, 0 
+		 *                   uses the CoAP timeout of the operator profile
+		 * @param &payload Address of pointer in which to store the hex payload
+		 * @param &payload_length Address of integer in which to store its length
+		 * @return True if a response was read
+		 */
+		bool _read_coap_response(int &response_code, int &more_block, uint16_t timeout_ms, 
+		                         const char *&payload, int &payload_length);
+#endif /* SARAN2_FEATURE_COAP */
+
+		/** Wake the module if it may be asleep, then discard any stale 
+		 *  input. Called with the driver lock held before each command.
+		 *  Only flushes if SARAN2_FEATURE_WAKE is disabled
+		 */
+		void _wake_and_flush();
+
+		/** Take one uplink from the token bucket, reading the APN rate 
+		 *  control first if an attach has made it stale. Called with the
+		 *  driver lock held before each CoAP request. Always succeeds if
+		 *  SARAN2_FEATURE_RATE_CONTROL is disabled
+		 *
+		 * @return True if the uplink may be sent
+		 */
+		bool _take_uplink_token();
+
+		/** Is an attach or uplink currently forbidden by a back-off? Called
+		 *  with the driver lock held. Always false if SARAN2_FEATURE_BACKOFF
+		 *  is disabled
+		 *
+		 * @return True if the request must not be sent
+		 */
+		bool _backoff_active();
+
+		/** Read the reject cause with a +CEREG report after a failed or 
+		 *  denied registration, starting a back-off if the network 
+		 *  rejected the device. Called with the driver lock held. Does 
+		 *  nothing if SARAN2_FEATURE_BACKOFF is disabled
+		 */
+		void _check_registration_reject();
+
+		/** Read a single line from the module, without the trailing CR LF
+		 *
+		 * @param *buffer Pointer to a byte array in which to store the line
+		 * @param size Size of buffer, including space for the terminator
+		 * @return Length of the line or -1 if nothing was received
+		 */
+		int _read_line(char *buffer, int size);
+
+#if SARAN2_FEATURE_TIME
+		/** Parse a "yy/MM/dd,hh:mm:ss[+-zz]" network time string and update
+		 *  the cached network time
+		 *
+		 * @param *text Pointer to the string containing the network time
+		 * @param error_ms Error of the network time at the point of receipt
+		 * @return True if a time was found and parsed
+		 */
+		bool _update_network_time(const char *text, uint32_t error_ms);
+
+		/** Out-of-band handler for +CTZV and +CTZEU NITZ URCs
+		 */
+		void _nitz_urc();
+#endif /* SARAN2_FEATURE_TIME */
+
+#if SARAN2_FEATURE_FOTA
+		/** Send a single firmware package segment with AT+NFWUPD=1
+		 *
+		 * @param segment Segment sequence number
+		 * @param *data Pointer to the segment data
+		 * @param length Number of bytes in the segment
+		 * @return True if the module acknowledged the segment
+		 */
+		bool _send_firmware_segment(uint16_t segment, const uint8_t *data, uint16_t length);
+#endif /* SARAN2_FEATURE_FOTA */
+
+		/** Hex-encode binary data straight onto the AT interface in small 
+		 *  pieces, so that payloads larger than ATCmdParser's send buffer 
+		 *  never need to be encoded into memory in full
+		 *
+		 * @param *data Pointer to the data to write
+		 * @param length Number of bytes to write
+		 */
+		void _write_hex(const uint8_t *data, size_t length);
+
+#if SARAN2_FEATURE_PSM
+		/** Read the PSM setting and both PSM timers with a single AT+CPSMS?. 
+		 *  Must be called with the driver lock held
+		 *
+		 * @param &psm Address of integer in which to store the PSM setting
+		 * @param *t3412 Pointer to Char array of at least 9 bytes in which to 
+		 *               store the T3412 binary string
+		 * @param *t3324 Pointer to Char array of at least 9 bytes in which to
+		 *               store the T3324 binary string
+		 * @return True if the settings were read
+		 */
+		bool _read_psm_settings(int &psm, char *t3412, char *t3324);
+
+		/** Query +CEREG at level 4 and store the registration status, reject
+		 *  cause and granted PSM timers. The URC level is restored to 0 
+		 *  afterwards. Must be called with the driver lock held
+		 *
+		 * @return True if the report was read
+		 */
+		bool _read_cereg_report();
+
+		/** Is the PSM fallback currently in effect?
+		 *
+		 * @return True if the fallback is enabled and PSM has not been granted
+		 */
+		bool _psm_fallback_active();
+#endif /* SARAN2_FEATURE_PSM */
+
+		/** Find the first occurrence of either of two delimiters in buffered
+		 *  response data, testing a 32-bit word at a time
+		 *
+		 * @param *data Pointer to the data to search
+		 * @param from Index at which to start searching
+		 * @param to Index at which to stop searching
+		 * @param first First delimiter to search for
+		 * @param second Second delimiter to search for
+		 * @return Index of the delimiter, or to if neither was found
+		 */
+		static int _find_delimiter(const char *data, int from, int to, char first, char second);
+
+		/** Split a buffered response line into comma-separated fields. Quoted
+		 *  fields are returned without their quotes and may contain commas.
+		 *  Fields point into line, nothing is copied
+		 *
+		 * @param *line Pointer to the response line
+		 * @param length Length of the response line
+		 * @param **fields Array in which to store a pointer to each field
+		 * @param *lengths Array in which to store the length of each field
+		 * @param max_fields Number of elements in fields and lengths
+		 * @return Number of fields found
+		 */
+		static int _split_fields(const char *line, int length, const char **fields, int *lengths, int max_fields);
+
+		/** Record the outcome and latency of a CoAP request in the health 
+		 *  counters and close its timeline. Parts belonging to disabled 
+		 *  features do nothing
+		 *
+		 * @param start Kernel millisecond count at the start of the request
+		 * @param status Return code of the request
+		 * @return status, so that it can be used in a return statement
+		 */
+		int _finish_coap_request(uint64_t start, int status);
+
+		/** Add a duration to a SARAN2_LATENCY_BUCKETS latency histogram
+		 *
+		 * @param *histogram Pointer to the histogram buckets
+		 * @param elapsed_ms Duration in milliseconds
+		 * @param bucket_ms Upper bound of the first bucket in milliseconds
+		 */
+		static void _histogram_add(uint32_t *histogram, uint64_t elapsed_ms, 
+		                           uint32_t bucket_ms = SARAN2_LATENCY_BUCKET_MS);
+
+		/** Estimate a quantile of a SARAN2_LATENCY_BUCKETS latency histogram
+		 *
+		 * @param *histogram Pointer to the histogram buckets
+		 * @param percent Quantile to estimate, i.e. 99 for p99
+		 * @param bucket_ms Upper bound of the first bucket in milliseconds
+		 * @return Upper bound of the bucket containing the quantile in ms,
+		 *         or 0 if the histogram is empty
+		 */
+		static uint32_t _histogram_quantile(const uint32_t *histogram, uint8_t percent, 
+		                                    uint32_t bucket_ms = SARAN2_LATENCY_BUCKET_MS);
+
+		/** Seed timeout and bounds of a tracked command
+		 */
+		struct CommandLimits_t
+		{
+			uint32_t seed_ms; /* 0 uses the operator AT timeout */
+			uint32_t min_ms;
+			uint32_t max_ms;
+		};
+
+		static const CommandLimits_t _command_limits[COMMAND_COUNT];
+
+		/** Timeout of a tracked command, learned from its observed latency 
+		 *  if SARAN2_FEATURE_ADAPTIVE_TIMEOUT is enabled and otherwise its 
+		 *  seed. Must be called with the driver lock held
+		 *
+		 * @param command Enumerated COMMAND_x value
+		 * @return Timeout in milliseconds
+		 */
+		uint32_t _command_timeout(uint8_t command);
+
+		/** Apply the timeout of a tracked command before sending it and
+		 *  note the time. Must be called with the driver lock held
+		 *
+		 * @param command Enumerated COMMAND_x value
+		 */
+		void _command_start(uint8_t command);
+
+		/** Record the response time of a tracked command and restore the 
+		 *  operator AT timeout. A timeout is recorded as a response at the
+		 *  timeout, so that a command that times out falsely gets longer
+		 *  timeouts until it stops doing so
+		 *
+		 * @param command Enumerated COMMAND_x value
+		 * @param ok Whether the expected response was received
+		 * @return ok, so that it can be used in a condition
+		 */
+		bool _command_end(uint8_t command, bool ok);
+
+		/** Timeline hooks called by each CoAP request with the driver lock
+		 *  held, at the start of the request and as each event is seen. 
+		 *  They do nothing if SARAN2_FEATURE_TIMELINE is disabled
+		 *
+		 * @param event CoapTimeline_t member to timestamp
+		 */
+		void _timeline_start();
+		void _timeline_mark(uint32_t CoapTimeline_t::*event);
+
+#if SARAN2_FEATURE_TIMELINE
+		/** Pass a completed timeline to the callback and add its phases to
+		 *  the histograms
+		 */
+		void _timeline_complete();
+
+		/** Out-of-band handler for +CSCON. Handles both the URC, which
+		 *  carries only the connection state, and the response to 
+		 *  AT+CSCON?, which the handler consumes before cscon() sees it
+		 */
+		void _cscon_urc();
+#endif /* SARAN2_FEATURE_TIMELINE */
+
+#if SARAN2_FEATURE_OPERATOR_PROFILES
+		/** Read the MCC and MNC of the serving network. Must be called with
+		 *  the driver lock held
+		 *
+		 * @param &mcc Address of integer in which to store the MCC
+		 * @param &mnc Address of integer in which to store the MNC
+		 * @return True if the module is registered and the PLMN was read
+		 */
+		bool _read_serving_plmn(uint16_t &mcc, uint16_t &mnc);
+
+		/** Read the operator reported by AT+COPS?, always consuming the 
+		 *  final OK. Must be called with the driver lock held
+		 *
+		 * @param &format Address of integer in which to store the <format>
+		 *                of the reply, -1 if the module is not registered
+		 * @param &oper Address of pointer in which to store <oper>, within 
+		 *              the line buffer
+		 * @param &oper_length Address of integer in which to store its length
+		 * @return True if the reply and its OK were read
+		 */
+		bool _read_operator(int &format, const char *&oper, int &oper_length);
+#endif /* SARAN2_FEATURE_OPERATOR_PROFILES */
+
+#if SARAN2_FEATURE_WARM_STATE
+		/** Read the IMEI into the cache. Must be called with the driver lock 
+		 *  held
+		 *
+		 * @return True if the IMEI was read
+		 */
+		bool _read_imei();
+
+		/** Read the registration status and serving cell with a +CEREG 
+		 *  level 2 report, restoring level 0 afterwards. Must be called 
+		 *  with the driver lock held
+		 *
+		 * @param &status Address of integer in which to store the status
+		 * @param &cell_id Address of integer in which to store the cell ID,
+		 *                 0xFFFFFFFF if none was reported
+		 * @return True if the report was read
+		 */
+		bool _read_registration(int &status, uint32_t &cell_id);
+
+		/** CRC-32 (IEEE 802.3) of a block of memory
+		 *
+		 * @param *data Pointer to the data
+		 * @param length Number of bytes
+		 * @return CRC-32
+		 */
+		static uint32_t _crc32(const uint8_t *data, size_t length);
+#endif /* SARAN2_FEATURE_WARM_STATE */
+
+#if SARAN2_FEATURE_HEALTH
+		/** Append a value to a buffer as an unsigned LEB128 varint
+		 *
+		 * @param *buffer Pointer to the byte array to write to
+		 * @param value Value to encode
+		 * @return Number of bytes written, at most 5
+		 */
+		static size_t _put_varint(uint8_t *buffer, uint32_t value);
+#endif /* SARAN2_FEATURE_HEALTH */
 
 		DigitalIn  _cts;
 		DigitalOut _rst;
@@ -575,6 +1871,222 @@ class SaraN2
 
 		UARTSerial  *_serial;
         ATCmdParser *_parser;
+#if SARAN2_FAULT_INJECTION
+		SaraN2FaultInjector *_fault;
+#endif
 		Mutex _smutex;
+
+#if SARAN2_FEATURE_ASYNC_BOOT
+		Thread     *_boot_thread = NULL;
+		EventFlags  _boot_flags;
+		Callback<void(int)> _ready_cb;
+		Callback<int()>     _configure_cb;
+		WarmState_t         _warm_state;
+		bool                _warm_state_given = false;
+		volatile int        _boot_status = FAIL_BOOT;
+#endif
+
+#if SARAN2_FEATURE_TIME
+		uint64_t _time_base_ms       = 0;
+		uint64_t _time_ref_ms        = 0;
+		uint32_t _time_base_error_ms = 0;
+		uint16_t _clock_drift_ppm    = SARAN2_CLOCK_DRIFT_PPM;
+		int      _time_zone          = 0;
+		bool     _time_synchronised  = false;
+#endif
+
+		char _line_buffer[SARAN2_LINE_BUFFER_SIZE];
+
+		uint32_t _at_timeout_ms   = SARAN2_AT_TIMEOUT_MS;
+		uint32_t _coap_timeout_ms = SARAN2_COAP_TIMEOUT_MS;
+		uint64_t _command_start_ms = 0;
+
+#if SARAN2_FEATURE_PSM
+		int  _requested_psm           = 0;
+		char _requested_t3412[9]      = "";
+		char _requested_t3324[9]      = "";
+		char _granted_t3412[9]        = "";
+		char _granted_t3324[9]        = "";
+		int  _registration_status     = UNKNOWN;
+		int  _reject_cause_type       = -1;
+		int  _reject_cause            = -1;
+		bool _psm_granted             = true;
+		bool _psm_granted_known       = false;
+		bool _psm_fallback            = false;
+		uint32_t _last_cell_id        = 0xFFFFFFFF;
+#endif
+
+#if SARAN2_FEATURE_COAP_PROFILES
+		int8_t _coap_profile          = -1;
+#endif
+
+#if SARAN2_FEATURE_NCONFIG
+		uint8_t _nconfig_mask         = 0;
+		uint8_t _nconfig_values       = 0;
+#endif
+
+#if SARAN2_FEATURE_HEALTH
+		Health_t _health = {};
+		uint32_t _health_interval_s = 0;
+		uint64_t _health_last_sent_ms = 0;
+		int      _last_psm_state = 0;
+#endif
+
+#if SARAN2_FEATURE_TIMELINE
+		Callback<void(const CoapTimeline_t &)> _timeline_cb;
+		CoapTimeline_t _timeline = {};
+		uint64_t _timeline_start_ms      = 0;
+		bool     _timeline_enabled       = false;
+		bool     _timeline_active        = false;
+		bool     _timeline_pending       = false;
+		uint32_t _phase_histogram[PHASE_COUNT][SARAN2_LATENCY_BUCKETS] = {};
+		int      _cscon_reply[2]         = { 0, 0 };
+		bool     _cscon_reply_valid      = false;
+#endif
+
+#if SARAN2_FEATURE_OPERATOR_PROFILES
+		OperatorProfile_t _operator_profiles[SARAN2_OPERATOR_PROFILES] = {};
+		OperatorProfile_t _operator_profile = SARAN2_DEFAULT_OPERATOR_PROFILE;
+		uint8_t _operator_profile_count   = 0;
+		bool    _operator_profile_auto    = false;
+		bool    _operator_profile_applied = false;
+#endif
+
+#if SARAN2_FEATURE_ADAPTIVE_TIMEOUT
+		uint32_t _command_latency[COMMAND_COUNT][SARAN2_LATENCY_BUCKETS] = {};
+#endif
+
+#if SARAN2_FEATURE_WARM_STATE
+		char _imei[16] = "";
+#endif
+
+#if SARAN2_FEATURE_WAKE
+		WakeStats_t _wake_stats       = {};
+		uint32_t    _wake_idle_ms     = SARAN2_WAKE_IDLE_MS;
+		uint64_t    _last_command_ms  = 0;
+#endif
+
+#if SARAN2_FEATURE_RATE_CONTROL
+		/** Refill the token bucket for the time elapsed since the last refill.
+		 *  Credit is kept in uplink-milliseconds so that one uplink costs
+		 *  _rate_unit_ms and max_rate uplinks are earned per _rate_unit_ms
+		 */
+		void _refill_uplink_tokens();
+
+		bool     _read_apn_rate_control();
+
+		uint32_t _rate_max               = 0;
+		uint32_t _rate_unit_ms           = 0;
+		uint64_t _rate_credit            = 0;
+		uint64_t _rate_refill_ms         = 0;
+		uint32_t _rate_deferred          = 0;
+		bool     _rate_exception_reports = false;
+		bool     _rate_stale             = true;
+		bool     _rate_pacing            = true;
+#endif
+
+#if SARAN2_FEATURE_COAP_METHODS
+		/** Send a confirmable CoAP request on the socket and wait for its 
+		 *  piggybacked or separate response
+		 *
+		 * @param code CoAP method code
+		 * @param fail Return code if the module does not accept the request
+		 * @param *send_data Pointer to the request body
+		 * @param length Number of bytes in the request body
+		 * @param content_format CoAP Content-Format of the body
+		 * @param *recv_data Pointer to a byte array of SARAN2_MAX_COAP_PAYLOAD
+		 *                   bytes in which to store the response payload
+		 * @param &recv_length Address of integer in which to store the
+		 *                     response payload length
+		 * @param &response_code Address of integer where the CoAP response 
+		 *                       class will be stored
+		 * @return Indicates success or failure reason
+		 */
+		int _coap_socket_request(uint8_t code, int fail, const uint8_t *send_data, size_t length, 
+		                         uint16_t content_format, uint8_t *recv_data, size_t &recv_length, 
+		                         int &response_code);
+
+		/** Open the UDP socket of the CoAP socket path. If the local port is
+		 *  still bound, i.e. by the driver's socket from before an MCU-only
+		 *  reset that no warm state carried over, the next ports are tried.
+		 *  Sockets the driver did not open are never closed. Must be called
+		 *  with the driver lock held
+		 *
+		 * @return True if the socket is open
+		 */
+		bool _open_coap_socket();
+
+		/** Build the CoAP header, token, Uri-Path and Content-Format options
+		 *  of a request
+		 *
+		 * @param code CoAP method code
+		 * @param content_format CoAP Content-Format, only sent if with_body
+		 * @param with_body Whether the request has a body
+		 * @param *header Pointer to SARAN2_COAP_HEADER_SIZE bytes in which 
+		 *                to build the header
+		 * @return Number of bytes written
+		 */
+		size_t _coap_header(uint8_t code, uint16_t content_format, bool with_body, uint8_t *header);
+
+		/** Send a CoAP message, header and optional payload, as one datagram 
+		 *  to the target. The payload is hex-encoded straight from the 
+		 *  caller's buffer. Must be called with the driver lock held
+		 *
+		 * @param *header Pointer to the CoAP header and options
+		 * @param header_length Number of bytes in the header
+		 * @param *payload Pointer to the payload
+		 * @param length Number of bytes in the payload, 0 for none
+		 */
+		void _send_coap_datagram(const uint8_t *header, size_t header_length, 
+		                         const uint8_t *payload, size_t length);
+
+		/** Wait for a datagram on the socket and read its first 
+		 *  SARAN2_COAP_SOCKET_READ bytes into the line buffer, draining the
+		 *  rest from the module. Must be called with the driver lock held
+		 *
+		 * @param timeout_ms Time to wait for the datagram
+		 * @param &truncated Address of boolean in which to store whether
+		 *                   bytes beyond SARAN2_COAP_SOCKET_READ were dropped
+		 * @return Length of the datagram kept or -1 if none was received
+		 */
+		int _read_coap_datagram(uint32_t timeout_ms, bool &truncated);
+
+		/** Read one AT+NSORF reply line. Must be called with the driver 
+		 *  lock held
+		 *
+		 * @param *buffer Pointer to the byte array to read the line into
+		 * @param size Size of buffer
+		 * @param &data Address of pointer in which to store the hex data
+		 * @param &data_length Address of integer in which to store its length
+		 * @param &remaining Address of integer in which to store the bytes 
+		 *                   of the datagram still unread
+		 * @return True if the reply was read
+		 */
+		bool _read_socket_reply(char *buffer, int size, const char *&data, int &data_length, int &remaining);
+
+		int      _coap_socket           = -1;
+		char     _coap_target_ip[16]    = "";
+		uint16_t _coap_target_port      = 5683;
+		char     _coap_target_path[SARAN2_COAP_PATH_SIZE] = "";
+		uint16_t _coap_message_id       = 0;
+#endif
+
+#if SARAN2_FEATURE_BACKOFF
+		/** Start or clear the back-off from the registration status and 
+		 *  reject cause just read by _read_cereg_report()
+		 */
+		void _update_backoff();
+
+		/** Next value of the xorshift32 jitter generator, seeded on first 
+		 *  use from the IMEI so that devices rejected together spread 
+		 *  their retries rather than draw the same sequence after reset
+		 */
+		uint32_t _backoff_random();
+
+		uint64_t _backoff_until_ms = 0;
+		int      _backoff_cause    = -1;
+		uint8_t  _backoff_rejects  = 0;
+		uint32_t _backoff_seed     = 0;
+#endif
 };
 
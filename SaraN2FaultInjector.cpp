@@ -0,0 +1,426 @@
+/**
+  * @file    SaraN2FaultInjector.cpp
+  * @version 0.5.0
+  * @author  Adam Mitchell
+  * @brief   C++ file of the fault-injecting UART wrapper used to measure
+  *          driver tail latency and recovery against a misbehaving module
+  */
+
+/** Includes
+ */
+#include "SaraN2FaultInjector.h"
+
+#if SARAN2_FAULT_INJECTION /* #endif at EoF */
+
+#include <errno.h>
+
+/** Constructor for the SaraN2FaultInjector class
+ *
+ * @param *fh Pointer to the FileHandle connected to the module
+ */
+SaraN2FaultInjector::SaraN2FaultInjector(FileHandle *fh) :
+	_fh(fh), _blocking(true), _line_length(0), _out_position(0), _out_length(0),
+	_release_ms(0), _seed(1), _scheduled(0), _line_count(0), _delay_ms(1000)
+{
+	memset(_rates, 0, sizeof(_rates));
+	memset(_counts, 0, sizeof(_counts));
+	strcpy(_urc, "+CSCON: 0");
+}
+
+/** Seed the random fault generator
+ *
+ * @param seed Any non-zero value
+ */
+void SaraN2FaultInjector::set_seed(uint32_t seed)
+{
+	_mutex.lock();
+
+	_seed = (seed != 0) ? seed : 1;
+
+	_mutex.unlock();
+}
+
+/** Set the probability of a fault type being injected into each line
+ *
+ * @param fault Enumerated FAULT_x value
+ * @param per_mille Probability in thousandths, 0 disables the fault
+ */
+void SaraN2FaultInjector::set_rate(uint8_t fault, uint16_t per_mille)
+{
+	if(fault == FAULT_NONE || fault >= FAULT_COUNT)
+	{
+		return;
+	}
+
+	_mutex.lock();
+
+	_rates[fault] = per_mille;
+
+	_mutex.unlock();
+}
+
+/** Inject a fault into a specific line, counted from the next line
+ *  received, i.e. 0 faults the next line and 2 the one after that
+ *
+ * @param fault Enumerated FAULT_x value
+ * @param line Number of lines to let through first
+ * @return True if the fault was scheduled, false if the schedule is full
+ */
+bool SaraN2FaultInjector::schedule(uint8_t fault, uint16_t line)
+{
+	if(fault == FAULT_NONE || fault >= FAULT_COUNT)
+	{
+		return false;
+	}
+
+	_mutex.lock();
+
+	if(_scheduled >= SARAN2_FAULT_SCHEDULE_SIZE)
+	{
+		_mutex.unlock();
+		return false;
+	}
+
+	_schedule[_scheduled].line = _line_count + line;
+	_schedule[_scheduled].fault = fault;
+	_scheduled++;
+
+	_mutex.unlock();
+
+	return true;
+}
+
+/** Set how long FAULT_DELAY holds a line back
+ *
+ * @param delay_ms Delay in milliseconds
+ */
+void SaraN2FaultInjector::set_delay(uint32_t delay_ms)
+{
+	_mutex.lock();
+
+	_delay_ms = delay_ms;
+
+	_mutex.unlock();
+}
+
+/** Set the URC injected by FAULT_URC
+ *
+ * @param *urc Pointer to the URC, without CR LF
+ */
+void SaraN2FaultInjector::set_urc(const char *urc)
+{
+	_mutex.lock();
+
+	strncpy(_urc, urc, SARAN2_FAULT_URC_SIZE);
+	_urc[SARAN2_FAULT_URC_SIZE] = '\0';
+
+	_mutex.unlock();
+}
+
+/** Remove all scheduled faults and set every rate to 0
+ */
+void SaraN2FaultInjector::clear()
+{
+	_mutex.lock();
+
+	memset(_rates, 0, sizeof(_rates));
+	_scheduled = 0;
+
+	_mutex.unlock();
+}
+
+/** Read the number of faults of a type injected so far
+ *
+ * @param fault Enumerated FAULT_x value
+ * @return Number of faults injected
+ */
+uint32_t SaraN2FaultInjector::injected(uint8_t fault)
+{
+	if(fault >= FAULT_COUNT)
+	{
+		return 0;
+	}
+
+	_mutex.lock();
+
+	uint32_t count = _counts[fault];
+
+	_mutex.unlock();
+
+	return count;
+}
+
+ssize_t SaraN2FaultInjector::read(void *buffer, size_t size)
+{
+	while(!_available())
+	{
+		if(!_blocking)
+		{
+			return -EAGAIN;
+		}
+
+		ThisThread::sleep_for(1);
+	}
+
+	_mutex.lock();
+
+	size_t length = _out_length - _out_position;
+	if(length > size)
+	{
+		length = size;
+	}
+
+	memcpy(buffer, &_out[_out_position], length);
+	_out_position += length;
+
+	_mutex.unlock();
+
+	return length;
+}
+
+ssize_t SaraN2FaultInjector::write(const void *buffer, size_t size)
+{
+	return _fh->write(buffer, size);
+}
+
+off_t SaraN2FaultInjector::seek(off_t offset, int whence)
+{
+	return -ESPIPE;
+}
+
+int SaraN2FaultInjector::close()
+{
+	return _fh->close();
+}
+
+int SaraN2FaultInjector::set_blocking(bool blocking)
+{
+	_blocking = blocking;
+
+	return 0;
+}
+
+bool SaraN2FaultInjector::is_blocking() const
+{
+	return _blocking;
+}
+
+short SaraN2FaultInjector::poll(short events) const
+{
+	short revents = 0;
+
+	if((events & POLLIN) && readable())
+	{
+		revents |= POLLIN;
+	}
+
+	if((events & POLLOUT) && writable())
+	{
+		revents |= POLLOUT;
+	}
+
+	return revents;
+}
+
+bool SaraN2FaultInjector::readable() const
+{
+	return const_cast<SaraN2FaultInjector *>(this)->_available();
+}
+
+bool SaraN2FaultInjector::writable() const
+{
+	return _fh->writable();
+}
+
+void SaraN2FaultInjector::sigio(Callback<void()> func)
+{
+	_fh->sigio(func);
+}
+
+/** Is faulted data ready to be read? Takes the lock and calls _fill()
+ *
+ * @return True if at least one byte can be read without blocking
+ */
+bool SaraN2FaultInjector::_available()
+{
+	_mutex.lock();
+
+	_fill();
+
+	bool available = _out_position < _out_length && Kernel::get_ms_count() >= _release_ms;
+
+	_mutex.unlock();
+
+	return available;
+}
+
+/** Move received bytes from the module into the line buffer and,
+ *  once a line is complete, fault it into the output buffer. Must
+ *  be called with the lock held
+ */
+void SaraN2FaultInjector::_fill()
+{
+	if(_out_position < _out_length)
+	{
+		return;
+	}
+
+	_out_position = 0;
+	_out_length = 0;
+
+	while(_out_length == 0 && _fh->readable())
+	{
+		char byte;
+
+		if(_fh->read(&byte, 1) != 1)
+		{
+			break;
+		}
+
+		_line[_line_length++] = byte;
+
+		if(byte == '\n' || _line_length == sizeof(_line))
+		{
+			_process_line();
+		}
+	}
+}
+
+/** Choose and apply the fault for the line in the line buffer
+ */
+void SaraN2FaultInjector::_process_line()
+{
+	size_t length = _line_length;
+	size_t content = length;
+
+	_line_length = 0;
+
+	while(content > 0 && (_line[content - 1] == '\r' || _line[content - 1] == '\n'))
+	{
+		content--;
+	}
+
+	/* Blank separator lines and pieces of over-long lines pass untouched */
+	if(content == 0 || _line[length - 1] != '\n')
+	{
+		_output(_line, length);
+		return;
+	}
+
+	uint8_t fault = _next_fault();
+
+	if(fault != FAULT_NONE)
+	{
+		_counts[fault]++;
+	}
+
+	switch(fault)
+	{
+		case FAULT_CORRUPT:
+			_line[_random() % content] ^= 1 << (_random() % 7);
+			_output(_line, length);
+			break;
+
+		case FAULT_TRUNCATE:
+			_output(_line, _random() % content);
+			_output("\r\n", 2);
+			break;
+
+		case FAULT_DROP:
+			break;
+
+		case FAULT_DUPLICATE:
+			_output(_line, length);
+			_output(_line, length);
+			break;
+
+		case FAULT_DELAY:
+			_output(_line, length);
+			_release_ms = Kernel::get_ms_count() + _delay_ms;
+			break;
+
+		case FAULT_URC:
+			_output("\r\n", 2);
+			_output(_urc, strlen(_urc));
+			_output("\r\n", 2);
+			_output(_line, length);
+			break;
+
+		case FAULT_RESET:
+			while(_fh->readable())
+			{
+				char byte;
+
+				if(_fh->read(&byte, 1) != 1)
+				{
+					break;
+				}
+			}
+			_output(SARAN2_FAULT_RESET_BANNER, strlen(SARAN2_FAULT_RESET_BANNER));
+			break;
+
+		default:
+			_output(_line, length);
+			break;
+	}
+}
+
+/** Choose the fault for the next non-empty line
+ *
+ * @return Enumerated FAULT_x value
+ */
+uint8_t SaraN2FaultInjector::_next_fault()
+{
+	uint32_t line = _line_count++;
+
+	for(uint8_t i = 0; i < _scheduled; i++)
+	{
+		if(_schedule[i].line == line)
+		{
+			uint8_t fault = _schedule[i].fault;
+
+			_schedule[i] = _schedule[--_scheduled];
+
+			return fault;
+		}
+	}
+
+	for(uint8_t fault = FAULT_NONE + 1; fault < FAULT_COUNT; fault++)
+	{
+		if(_rates[fault] != 0 && _random() % 1000 < _rates[fault])
+		{
+			return fault;
+		}
+	}
+
+	return FAULT_NONE;
+}
+
+/** Append bytes to the output buffer
+ *
+ * @param *data Pointer to the bytes to append
+ * @param length Number of bytes to append
+ */
+void SaraN2FaultInjector::_output(const char *data, size_t length)
+{
+	if(length > sizeof(_out) - _out_length)
+	{
+		length = sizeof(_out) - _out_length;
+	}
+
+	memcpy(&_out[_out_length], data, length);
+	_out_length += length;
+}
+
+/** Next value of the xorshift32 random fault generator
+ */
+uint32_t SaraN2FaultInjector::_random()
+{
+	_seed ^= _seed << 13;
+	_seed ^= _seed >> 17;
+	_seed ^= _seed << 5;
+
+	return _seed;
+}
+
+#endif
@@ -0,0 +1,198 @@
+/**
+  * @file    SaraN2FaultInjector.h
+  * @version 0.5.0
+  * @author  Adam Mitchell
+  * @brief   Header file of the fault-injecting UART wrapper used to measure
+  *          driver tail latency and recovery against a misbehaving module
+  */
+
+/** Define to prevent recursive inclusion
+ */
+#pragma once
+
+/** Includes
+ */
+#include <mbed.h>
+
+/** Set to 1 to place a SaraN2FaultInjector between the UART and the AT
+ *  command parser of every SaraN2 object. Test builds only
+ */
+#ifndef SARAN2_FAULT_INJECTION
+#define SARAN2_FAULT_INJECTION 0
+#endif
+
+/** Longest module response line that can be faulted. Longer lines are
+ *  passed through untouched in pieces of this size
+ */
+#define SARAN2_FAULT_LINE_SIZE 576
+
+/** Number of faults that can be scheduled at once with schedule()
+ */
+#define SARAN2_FAULT_SCHEDULE_SIZE 8
+
+/** Maximum length of the URC injected by FAULT_URC, excluding CR LF
+ */
+#define SARAN2_FAULT_URC_SIZE 32
+
+/** Lines emitted in place of the response by FAULT_RESET, as printed by
+ *  the module as it restarts. reboot_module() waits for the "u-blox"
+ *  line and then "OK"
+ */
+#define SARAN2_FAULT_RESET_BANNER "\r\nREBOOT_CAUSE_APPLICATION_AT\r\nu-blox\r\nOK\r\n"
+
+/** FileHandle that sits between the UART and ATCmdParser and injects
+ *  faults into the lines received from the module. Each non-empty line
+ *  is a candidate for one fault, chosen either by a script of line
+ *  numbers given to schedule() or at random with set_rate(). Random
+ *  faults are drawn from a seeded generator so that a run can be
+ *  repeated exactly. Commands sent to the module are passed through
+ *  unchanged
+ */
+class SaraN2FaultInjector : public FileHandle
+{
+
+	public:
+
+		/** Fault types
+		 */
+		enum
+		{
+			FAULT_NONE      = 0,
+			FAULT_CORRUPT   = 1, /* flip one bit of one character */
+			FAULT_TRUNCATE  = 2, /* cut the line short */
+			FAULT_DROP      = 3, /* lose the line, i.e. a missing OK */
+			FAULT_DUPLICATE = 4, /* deliver the line twice */
+			FAULT_DELAY     = 5, /* hold the line back for set_delay() ms */
+			FAULT_URC       = 6, /* deliver set_urc() before the line */
+			FAULT_RESET     = 7, /* discard pending data and emit a reboot banner */
+			FAULT_COUNT     = 8
+		};
+
+		/** Constructor for the SaraN2FaultInjector class
+		 *
+		 * @param *fh Pointer to the FileHandle connected to the module
+		 */
+		SaraN2FaultInjector(FileHandle *fh);
+
+		/** Seed the random fault generator
+		 *
+		 * @param seed Any non-zero value
+		 */
+		void set_seed(uint32_t seed);
+
+		/** Set the probability of a fault type being injected into each line
+		 *
+		 * @param fault Enumerated FAULT_x value
+		 * @param per_mille Probability in thousandths, 0 disables the fault
+		 */
+		void set_rate(uint8_t fault, uint16_t per_mille);
+
+		/** Inject a fault into a specific line, counted from the next line
+		 *  received, i.e. 0 faults the next line and 2 the one after that
+		 *
+		 * @param fault Enumerated FAULT_x value
+		 * @param line Number of lines to let through first
+		 * @return True if the fault was scheduled, false if the schedule is full
+		 */
+		bool schedule(uint8_t fault, uint16_t line);
+
+		/** Set how long FAULT_DELAY holds a line back
+		 *
+		 * @param delay_ms Delay in milliseconds
+		 */
+		void set_delay(uint32_t delay_ms);
+
+		/** Set the URC injected by FAULT_URC
+		 *
+		 * @param *urc Pointer to the URC, without CR LF
+		 */
+		void set_urc(const char *urc);
+
+		/** Remove all scheduled faults and set every rate to 0
+		 */
+		void clear();
+
+		/** Read the number of faults of a type injected so far
+		 *
+		 * @param fault Enumerated FAULT_x value
+		 * @return Number of faults injected
+		 */
+		uint32_t injected(uint8_t fault);
+
+		/** FileHandle interface
+		 */
+		virtual ssize_t read(void *buffer, size_t size);
+		virtual ssize_t write(const void *buffer, size_t size);
+		virtual off_t seek(off_t offset, int whence = SEEK_SET);
+		virtual int close();
+		virtual int set_blocking(bool blocking);
+		virtual bool is_blocking() const;
+		virtual short poll(short events) const;
+		virtual bool readable() const;
+		virtual bool writable() const;
+		virtual void sigio(Callback<void()> func);
+
+
+	private:
+
+		/** Scheduled fault
+		 */
+		struct Scheduled_t
+		{
+			uint32_t line;
+			uint8_t  fault;
+		};
+
+		/** Move received bytes from the module into the line buffer and,
+		 *  once a line is complete, fault it into the output buffer. Must
+		 *  be called with the lock held
+		 */
+		void _fill();
+
+		/** Is faulted data ready to be read? Takes the lock and calls _fill()
+		 *
+		 * @return True if at least one byte can be read without blocking
+		 */
+		bool _available();
+
+		/** Choose and apply the fault for the line in the line buffer
+		 */
+		void _process_line();
+
+		/** Choose the fault for the next non-empty line
+		 *
+		 * @return Enumerated FAULT_x value
+		 */
+		uint8_t _next_fault();
+
+		/** Append bytes to the output buffer
+		 *
+		 * @param *data Pointer to the bytes to append
+		 * @param length Number of bytes to append
+		 */
+		void _output(const char *data, size_t length);
+
+		/** Next value of the xorshift32 random fault generator
+		 */
+		uint32_t _random();
+
+		FileHandle *_fh;
+		Mutex       _mutex;
+		bool        _blocking;
+
+		char     _line[SARAN2_FAULT_LINE_SIZE];
+		size_t   _line_length;
+		char     _out[2 * SARAN2_FAULT_LINE_SIZE + SARAN2_FAULT_URC_SIZE + 4];
+		size_t   _out_position;
+		size_t   _out_length;
+		uint64_t _release_ms;
+
+		uint32_t    _seed;
+		uint16_t    _rates[FAULT_COUNT];
+		Scheduled_t _schedule[SARAN2_FAULT_SCHEDULE_SIZE];
+		uint8_t     _scheduled;
+		uint32_t    _line_count;
+		uint32_t    _delay_ms;
+		char        _urc[SARAN2_FAULT_URC_SIZE + 1];
+		uint32_t    _counts[FAULT_COUNT];
+};
@@ -0,0 +1,147 @@
+/**
+  * @file    SaraN2ReportFilter.cpp
+  * @version 0.5.0
+  * @author  Adam Mitchell
+  * @brief   C++ file of the report-by-exception uplink filter
+  */
+
+/** Includes
+ */
+#include "SaraN2ReportFilter.h"
+
+#include <string.h>
+
+/** Constructor for the SaraN2ReportFilter class
+ *
+ * @param uplink_energy_uj Estimated energy of one uplink in
+ *                         microjoules, used to report energy saved
+ */
+SaraN2ReportFilter::SaraN2ReportFilter(uint32_t uplink_energy_uj) :
+	_uplink_energy_uj(uplink_energy_uj)
+{
+	memset(_channels, 0, sizeof(_channels));
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+/** Configure a channel and reset its state, so that the next report
+ *  is always sent
+ *
+ * @param channel Channel number, less than SARAN2_FILTER_CHANNELS
+ * @param *fields Pointer to the parameters of each field
+ * @param field_count Number of fields, at most SARAN2_FILTER_FIELDS
+ * @param max_silence_ms Longest time without a report before one is
+ *                       forced, 0 for no heartbeat
+ * @return Indicates success or failure reason
+ */
+int SaraN2ReportFilter::configure(uint8_t channel, const Field_t *fields, uint8_t field_count, uint32_t max_silence_ms)
+{
+	if(channel >= SARAN2_FILTER_CHANNELS)
+	{
+		return SaraN2ReportFilter::INVALID_CHANNEL;
+	}
+
+	if(field_count == 0 || field_count > SARAN2_FILTER_FIELDS)
+	{
+		return SaraN2ReportFilter::INVALID_FIELDS;
+	}
+
+	Channel_t &state = _channels[channel];
+
+	memcpy(state.fields, fields, field_count * sizeof(Field_t));
+	state.field_count = field_count;
+	state.max_silence_ms = max_silence_ms;
+	state.reported = false;
+
+	return SaraN2ReportFilter::FILTER_OK;
+}
+
+/** Decide whether a report should be sent. If it should, the values
+ *  become the reference for the deadbands and thresholds
+ *
+ * @param channel Channel number the report belongs to
+ * @param *values Pointer to one value per configured field
+ * @param now_ms Current time in milliseconds, from any monotonic clock
+ * @return SUPPRESS, the reason to send or INVALID_CHANNEL
+ */
+int SaraN2ReportFilter::evaluate(uint8_t channel, const float *values, uint32_t now_ms)
+{
+	if(channel >= SARAN2_FILTER_CHANNELS || _channels[channel].field_count == 0)
+	{
+		return SaraN2ReportFilter::INVALID_CHANNEL;
+	}
+
+	Channel_t &state = _channels[channel];
+	int result = SaraN2ReportFilter::SUPPRESS;
+
+	if(!state.reported)
+	{
+		result = SaraN2ReportFilter::SEND_FIRST;
+	}
+	else
+	{
+		for(uint8_t i = 0; i < state.field_count; i++)
+		{
+			const Field_t &field = state.fields[i];
+			float delta = values[i] - state.last[i];
+
+			/* A threshold crossing outranks a change, so stop looking once found */
+			if(field.use_threshold && (values[i] >= field.threshold) != (state.last[i] >= field.threshold))
+			{
+				result = SaraN2ReportFilter::SEND_THRESHOLD;
+				break;
+			}
+
+			if(delta > field.deadband || -delta > field.deadband)
+			{
+				result = SaraN2ReportFilter::SEND_CHANGE;
+			}
+		}
+
+		/* Unsigned subtraction keeps the interval correct across wrap-around */
+		if(result == SaraN2ReportFilter::SUPPRESS && state.max_silence_ms != 0 &&
+		   now_ms - state.last_sent_ms >= state.max_silence_ms)
+		{
+			result = SaraN2ReportFilter::SEND_HEARTBEAT;
+		}
+	}
+
+	if(result == SaraN2ReportFilter::SUPPRESS)
+	{
+		_stats.suppressed++;
+		_stats.energy_saved_uj += _uplink_energy_uj;
+		return result;
+	}
+
+	memcpy(state.last, values, state.field_count * sizeof(float));
+	state.last_sent_ms = now_ms;
+	state.reported = true;
+
+	_stats.sent++;
+
+	return result;
+}
+
+/** Set the estimated energy of one uplink
+ *
+ * @param uplink_energy_uj Energy in microjoules
+ */
+void SaraN2ReportFilter::set_uplink_energy(uint32_t uplink_energy_uj)
+{
+	_uplink_energy_uj = uplink_energy_uj;
+}
+
+/** Copy the suppressed versus sent counts and estimated energy saved
+ *
+ * @param &stats Address of Stats_t in which to store the counts
+ */
+void SaraN2ReportFilter::get_stats(Stats_t &stats)
+{
+	stats = _stats;
+}
+
+/** Clear the suppressed versus sent counts
+ */
+void SaraN2ReportFilter::reset_stats()
+{
+	memset(&_stats, 0, sizeof(_stats));
+}
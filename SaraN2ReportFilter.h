@@ -0,0 +1,141 @@
+/**
+  * @file    SaraN2ReportFilter.h
+  * @version 0.5.0
+  * @author  Adam Mitchell
+  * @brief   Header file of the report-by-exception uplink filter
+  */
+
+/** Define to prevent recursive inclusion
+ */
+#pragma once
+
+/** Includes
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+/** Filter-specific #defines
+ */
+#ifndef SARAN2_FILTER_CHANNELS
+#define SARAN2_FILTER_CHANNELS 4
+#endif
+
+#ifndef SARAN2_FILTER_FIELDS
+#define SARAN2_FILTER_FIELDS 8
+#endif
+
+/** Decides whether a periodic report is worth an uplink. A report is sent
+ *  when any field has moved by more than its deadband since the last report
+ *  sent on the channel, when any field crosses its threshold, or when the
+ *  channel has been silent for its maximum silence interval. Everything
+ *  else is suppressed, i.e.
+ *
+ *  if(filter.evaluate(CHANNEL_ENV, values, Kernel::get_ms_count()) > SaraN2ReportFilter::SUPPRESS)
+ *  {
+ *      modem.coap_post(...);
+ *  }
+ *
+ *  State is kept per channel in a fixed table of SARAN2_FILTER_CHANNELS
+ *  channels of up to SARAN2_FILTER_FIELDS fields, so nothing is allocated
+ */
+class SaraN2ReportFilter
+{
+
+	public:
+
+		/** Result of evaluate() and function return codes
+		 */
+		enum
+		{
+			SUPPRESS          = 0,
+			SEND_FIRST        = 1,
+			SEND_CHANGE       = 2,
+			SEND_THRESHOLD    = 3,
+			SEND_HEARTBEAT    = 4,
+			INVALID_CHANNEL   = -1,
+			INVALID_FIELDS    = -2,
+			FILTER_OK         = 0
+		};
+
+		/** Filter parameters of a single field
+		 */
+		struct Field_t
+		{
+			float deadband;       /* change that is treated as sensor noise */
+			float threshold;      /* level whose crossing is always reported */
+			bool  use_threshold;
+		};
+
+		/** Suppressed versus sent counts, over all channels
+		 */
+		struct Stats_t
+		{
+			uint32_t sent;
+			uint32_t suppressed;
+			uint64_t energy_saved_uj;
+		};
+
+		/** Constructor for the SaraN2ReportFilter class
+		 *
+		 * @param uplink_energy_uj Estimated energy of one uplink in
+		 *                         microjoules, used to report energy saved
+		 */
+		SaraN2ReportFilter(uint32_t uplink_energy_uj = 0);
+
+		/** Configure a channel and reset its state, so that the next report
+		 *  is always sent
+		 *
+		 * @param channel Channel number, less than SARAN2_FILTER_CHANNELS
+		 * @param *fields Pointer to the parameters of each field
+		 * @param field_count Number of fields, at most SARAN2_FILTER_FIELDS
+		 * @param max_silence_ms Longest time without a report before one is
+		 *                       forced, 0 for no heartbeat
+		 * @return Indicates success or failure reason
+		 */
+		int configure(uint8_t channel, const Field_t *fields, uint8_t field_count, uint32_t max_silence_ms);
+
+		/** Decide whether a report should be sent. If it should, the values
+		 *  become the reference for the deadbands and thresholds
+		 *
+		 * @param channel Channel number the report belongs to
+		 * @param *values Pointer to one value per configured field
+		 * @param now_ms Current time in milliseconds, from any monotonic clock
+		 * @return SUPPRESS, the reason to send or INVALID_CHANNEL
+		 */
+		int evaluate(uint8_t channel, const float *values, uint32_t now_ms);
+
+		/** Set the estimated energy of one uplink
+		 *
+		 * @param uplink_energy_uj Energy in microjoules
+		 */
+		void set_uplink_energy(uint32_t uplink_energy_uj);
+
+		/** Copy the suppressed versus sent counts and estimated energy saved
+		 *
+		 * @param &stats Address of Stats_t in which to store the counts
+		 */
+		void get_stats(Stats_t &stats);
+
+		/** Clear the suppressed versus sent counts
+		 */
+		void reset_stats();
+
+
+	private:
+
+		/** State of a single channel
+		 */
+		struct Channel_t
+		{
+			Field_t  fields[SARAN2_FILTER_FIELDS];
+			float    last[SARAN2_FILTER_FIELDS];
+			uint32_t max_silence_ms;
+			uint32_t last_sent_ms;
+			uint8_t  field_count;
+			bool     reported;
+		};
+
+		Channel_t _channels[SARAN2_FILTER_CHANNELS];
+		Stats_t   _stats;
+		uint32_t  _uplink_energy_uj;
+};
@@ -0,0 +1,403 @@
+/**
+  * @file    SaraN2Schc.cpp
+  * @version 0.5.0
+  * @author  Adam Mitchell
+  * @brief   C++ file of the SCHC (RFC 8724) IPv6/UDP/CoAP header compressor
+  */
+
+/** Includes
+ */
+#include "SaraN2Schc.h"
+
+#include <string.h>
+
+/** Header sizes
+ */
+#define IPV6_HEADER_SIZE 40
+#define UDP_HEADER_SIZE  8
+#define COAP_HEADER_SIZE 4
+#define UDP_PROTOCOL     17
+
+const SaraN2Schc::Layout_t SaraN2Schc::_layout[FID_COUNT] =
+{
+	{   0,  4 }, /* IPv6 version */
+	{   4,  8 }, /* IPv6 traffic class */
+	{  12, 20 }, /* IPv6 flow label */
+	{  48,  8 }, /* IPv6 next header */
+	{  56,  8 }, /* IPv6 hop limit */
+	{  64, 64 }, /* IPv6 source prefix */
+	{ 128, 64 }, /* IPv6 source IID */
+	{ 192, 64 }, /* IPv6 destination prefix */
+	{ 256, 64 }, /* IPv6 destination IID */
+	{ 320, 16 }, /* UDP source port */
+	{ 336, 16 }, /* UDP destination port */
+	{ 384,  2 }, /* CoAP version */
+	{ 386,  2 }, /* CoAP type */
+	{ 388,  4 }, /* CoAP token length */
+	{ 392,  8 }, /* CoAP code */
+	{ 400, 16 }, /* CoAP message ID */
+	{ 416,  0 }  /* CoAP token */
+};
+
+/** Compress an IPv6/UDP/CoAP packet with the first matching rule
+ *
+ * @param &context Rules to compress with
+ * @param *packet Pointer to the packet, starting at the IPv6 header
+ * @param length Number of bytes in the packet
+ * @param *output Pointer to a byte array in which to store the result.
+ *                length + 1 bytes is always sufficient
+ * @param size Size of output in bytes
+ * @return Number of bytes written or OUTPUT_TOO_SMALL
+ */
+int SaraN2Schc::compress(const Context_t &context, const uint8_t *packet, size_t length,
+                         uint8_t *output, size_t size)
+{
+	const size_t fixed = IPV6_HEADER_SIZE + UDP_HEADER_SIZE + COAP_HEADER_SIZE;
+
+	uint8_t tkl = (length >= fixed) ? (packet[IPV6_HEADER_SIZE + UDP_HEADER_SIZE] & 0x0F) : 0;
+	size_t header = fixed + tkl;
+
+	const Rule_t *rule = NULL;
+
+	if(length >= header && tkl <= 8 && (packet[0] >> 4) == 6 && packet[6] == UDP_PROTOCOL)
+	{
+		for(uint8_t r = 0; r < context.count; r++)
+		{
+			if(_matches(context.rules[r], packet, tkl))
+			{
+				rule = &context.rules[r];
+				break;
+			}
+		}
+	}
+
+	if(rule == NULL)
+	{
+		if(length + 1 > size)
+		{
+			return SaraN2Schc::OUTPUT_TOO_SMALL;
+		}
+
+		output[0] = SARAN2_SCHC_NO_COMPRESSION;
+		memcpy(&output[1], packet, length);
+
+		return length + 1;
+	}
+
+	/* The residue is never longer than the headers it replaces */
+	if(size < 1 + header)
+	{
+		return SaraN2Schc::OUTPUT_TOO_SMALL;
+	}
+
+	memset(output, 0, 1 + header);
+	output[0] = rule->id;
+
+	size_t bit = 8;
+
+	for(uint8_t fid = 0; fid < FID_COUNT; fid++)
+	{
+		uint8_t bits = (fid == FID_COAP_TOKEN) ? tkl * 8 : _layout[fid].bits;
+		uint64_t value = _get_bits(packet, _layout[fid].bit, bits);
+		const Field_t *field = _find_field(*rule, fid);
+
+		if(field != NULL && field->cda == CDA_NOT_SENT)
+		{
+			continue;
+		}
+
+		if(field != NULL && field->cda == CDA_LSB)
+		{
+			bits -= field->msb_bits;
+		}
+
+		_set_bits(output, bit, bits, value);
+		bit += bits;
+	}
+
+	size_t n = (bit + 7) / 8;
+
+	if(n + (length - header) > size)
+	{
+		return SaraN2Schc::OUTPUT_TOO_SMALL;
+	}
+
+	memcpy(&output[n], &packet[header], length - header);
+
+	return n + (length - header);
+}
+
+/** Rebuild a packet produced by compress()
+ *
+ * @param &context Rules the packet was compressed with
+ * @param *input Pointer to the compressed packet
+ * @param length Number of bytes in the compressed packet
+ * @param *packet Pointer to a byte array in which to store the packet
+ * @param size Size of packet in bytes
+ * @return Number of bytes written, OUTPUT_TOO_SMALL, INVALID_PACKET
+ *         or UNKNOWN_RULE
+ */
+int SaraN2Schc::decompress(const Context_t &context, const uint8_t *input, size_t length,
+                           uint8_t *packet, size_t size)
+{
+	if(length < 1)
+	{
+		return SaraN2Schc::INVALID_PACKET;
+	}
+
+	if(input[0] == SARAN2_SCHC_NO_COMPRESSION)
+	{
+		if(length - 1 > size)
+		{
+			return SaraN2Schc::OUTPUT_TOO_SMALL;
+		}
+
+		memcpy(packet, &input[1], length - 1);
+
+		return length - 1;
+	}
+
+	const Rule_t *rule = NULL;
+
+	for(uint8_t r = 0; r < context.count; r++)
+	{
+		if(context.rules[r].id == input[0])
+		{
+			rule = &context.rules[r];
+			break;
+		}
+	}
+
+	if(rule == NULL)
+	{
+		return SaraN2Schc::UNKNOWN_RULE;
+	}
+
+	if(size < SARAN2_SCHC_MAX_HEADER)
+	{
+		return SaraN2Schc::OUTPUT_TOO_SMALL;
+	}
+
+	memset(packet, 0, SARAN2_SCHC_MAX_HEADER);
+
+	size_t bit = 8;
+	uint8_t tkl = 0;
+
+	for(uint8_t fid = 0; fid < FID_COUNT; fid++)
+	{
+		uint8_t bits = (fid == FID_COAP_TOKEN) ? tkl * 8 : _layout[fid].bits;
+		const Field_t *field = _find_field(*rule, fid);
+		uint64_t value;
+
+		if(field != NULL && field->cda == CDA_NOT_SENT)
+		{
+			value = field->target;
+		}
+		else
+		{
+			uint8_t sent = (field != NULL && field->cda == CDA_LSB) ? bits - field->msb_bits : bits;
+
+			if(bit + sent > length * 8)
+			{
+				return SaraN2Schc::INVALID_PACKET;
+			}
+
+			value = _get_bits(input, bit, sent);
+			bit += sent;
+
+			if(sent < bits)
+			{
+				/* Restore the most significant bits from the target */
+				value |= (field->target >> sent) << sent;
+			}
+		}
+
+		_set_bits(packet, _layout[fid].bit, bits, value);
+
+		if(fid == FID_COAP_TKL)
+		{
+			tkl = value;
+			if(tkl > 8)
+			{
+				return SaraN2Schc::INVALID_PACKET;
+			}
+		}
+	}
+
+	size_t header = IPV6_HEADER_SIZE + UDP_HEADER_SIZE + COAP_HEADER_SIZE + tkl;
+	size_t n = (bit + 7) / 8;
+
+	if(n > length)
+	{
+		return SaraN2Schc::INVALID_PACKET;
+	}
+
+	if(header + (length - n) > size)
+	{
+		return SaraN2Schc::OUTPUT_TOO_SMALL;
+	}
+
+	memcpy(&packet[header], &input[n], length - n);
+
+	_compute_fields(packet, header + (length - n));
+
+	return header + (length - n);
+}
+
+/** Find the description of a field in a rule
+ *
+ * @param &rule Rule to search
+ * @param fid Field identifier
+ * @return Pointer to the field or NULL if the rule does not list it
+ */
+const SaraN2Schc::Field_t *SaraN2Schc::_find_field(const Rule_t &rule, uint8_t fid)
+{
+	for(uint8_t i = 0; i < rule.count; i++)
+	{
+		if(rule.fields[i].fid == fid)
+		{
+			return &rule.fields[i];
+		}
+	}
+
+	return NULL;
+}
+
+/** Does every field described by a rule match the packet?
+ *
+ * @param &rule Rule to test
+ * @param *packet Pointer to the packet
+ * @param tkl CoAP token length of the packet
+ * @return True if the rule can compress the packet
+ */
+bool SaraN2Schc::_matches(const Rule_t &rule, const uint8_t *packet, uint8_t tkl)
+{
+	for(uint8_t i = 0; i < rule.count; i++)
+	{
+		const Field_t &field = rule.fields[i];
+
+		if(field.fid >= FID_COUNT)
+		{
+			return false;
+		}
+
+		uint8_t bits = (field.fid == FID_COAP_TOKEN) ? tkl * 8 : _layout[field.fid].bits;
+		uint64_t value = _get_bits(packet, _layout[field.fid].bit, bits);
+
+		switch(field.mo)
+		{
+			case MO_EQUAL:
+				if(value != field.target)
+				{
+					return false;
+				}
+				break;
+
+			case MO_MSB:
+				if(field.msb_bits > bits ||
+				   (field.msb_bits != 0 && (value >> (bits - field.msb_bits)) != (field.target >> (bits - field.msb_bits))))
+				{
+					return false;
+				}
+				break;
+
+			case MO_IGNORE:
+				break;
+
+			default:
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/** Read up to 64 bits, most significant bit first
+ *
+ * @param *data Pointer to the data to read from
+ * @param bit Index of the first bit
+ * @param bits Number of bits to read
+ * @return Bits read
+ */
+uint64_t SaraN2Schc::_get_bits(const uint8_t *data, size_t bit, uint8_t bits)
+{
+	uint64_t value = 0;
+
+	for(uint8_t i = 0; i < bits; i++, bit++)
+	{
+		value = (value << 1) | ((data[bit >> 3] >> (7 - (bit & 7))) & 1);
+	}
+
+	return value;
+}
+
+/** Write up to 64 bits, most significant bit first
+ *
+ * @param *data Pointer to the data to write to
+ * @param bit Index of the first bit
+ * @param bits Number of bits to write
+ * @param value Bits to write
+ */
+void SaraN2Schc::_set_bits(uint8_t *data, size_t bit, uint8_t bits, uint64_t value)
+{
+	for(int i = bits - 1; i >= 0; i--, bit++)
+	{
+		uint8_t mask = 0x80 >> (bit & 7);
+
+		if((value >> i) & 1)
+		{
+			data[bit >> 3] |= mask;
+		}
+		else
+		{
+			data[bit >> 3] &= ~mask;
+		}
+	}
+}
+
+/** Fill in the IPv6 payload length, UDP length and UDP checksum
+ *
+ * @param *packet Pointer to the packet
+ * @param length Number of bytes in the packet
+ */
+void SaraN2Schc::_compute_fields(uint8_t *packet, size_t length)
+{
+	uint16_t payload = length - IPV6_HEADER_SIZE;
+	uint8_t *udp = &packet[IPV6_HEADER_SIZE];
+
+	packet[4] = payload >> 8;
+	packet[5] = payload;
+	udp[4] = payload >> 8;
+	udp[5] = payload;
+	udp[6] = 0;
+	udp[7] = 0;
+
+	/* Pseudo-header: source and destination address, UDP length and
+	 * next header, followed by the UDP header and data
+	 */
+	uint32_t sum = payload + UDP_PROTOCOL;
+
+	for(size_t i = 8; i < IPV6_HEADER_SIZE; i += 2)
+	{
+		sum += (packet[i] << 8) | packet[i + 1];
+	}
+
+	for(size_t i = 0; i < payload; i += 2)
+	{
+		sum += (udp[i] << 8) | ((i + 1 < payload) ? udp[i + 1] : 0);
+	}
+
+	while(sum >> 16)
+	{
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
+
+	uint16_t checksum = ~sum;
+	if(checksum == 0)
+	{
+		checksum = 0xFFFF;
+	}
+
+	udp[6] = checksum >> 8;
+	udp[7] = checksum;
+}
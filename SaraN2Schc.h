@@ -0,0 +1,209 @@
+/**
+  * @file    SaraN2Schc.h
+  * @version 0.5.0
+  * @author  Adam Mitchell
+  * @brief   Header file of the SCHC (RFC 8724) IPv6/UDP/CoAP header
+  *          compressor. Has no Mbed dependencies so that the same code and
+  *          rule context can decompress packets server-side
+  */
+
+/** Define to prevent recursive inclusion
+ */
+#pragma once
+
+/** Includes
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+/** Codec-specific #defines
+ */
+#define SARAN2_SCHC_NO_COMPRESSION 0xFF
+#define SARAN2_SCHC_MAX_HEADER     60
+
+/** Static Context Header Compression of the IPv6, UDP and fixed CoAP headers
+ *  of a packet. A compressed packet is laid out as:
+ *
+ *  [rule id] [residue, bit-packed and padded to a byte] [CoAP options and payload]
+ *
+ *  Each rule describes the fields it compresses with a target value, a
+ *  matching operator and a compression/decompression action:
+ *
+ *      MO_EQUAL  + CDA_NOT_SENT    field elided, restored from the target
+ *      MO_MSB(n) + CDA_LSB         only the low bits are sent
+ *      MO_IGNORE + CDA_VALUE_SENT  field sent in full
+ *
+ *  Fields a rule does not list are sent in full, which keeps rules short.
+ *  The IPv6 payload length, UDP length and UDP checksum are always
+ *  recomputed on decompression and never sent. Packets that match no rule
+ *  are sent whole behind SARAN2_SCHC_NO_COMPRESSION. CoAP options are not
+ *  compressed, and fragmentation is not implemented since NB-IoT carries
+ *  packets far larger than these headers
+ */
+class SaraN2Schc
+{
+
+	public:
+
+		/** Function return codes
+		 */
+		enum
+		{
+			OUTPUT_TOO_SMALL = -1,
+			INVALID_PACKET   = -2,
+			UNKNOWN_RULE     = -3
+		};
+
+		/** Field identifiers, in the order their residues are sent
+		 */
+		enum
+		{
+			FID_IPV6_VERSION       = 0,
+			FID_IPV6_TRAFFIC_CLASS = 1,
+			FID_IPV6_FLOW_LABEL    = 2,
+			FID_IPV6_NEXT_HEADER   = 3,
+			FID_IPV6_HOP_LIMIT     = 4,
+			FID_IPV6_SRC_PREFIX    = 5,
+			FID_IPV6_SRC_IID       = 6,
+			FID_IPV6_DST_PREFIX    = 7,
+			FID_IPV6_DST_IID       = 8,
+			FID_UDP_SRC_PORT       = 9,
+			FID_UDP_DST_PORT       = 10,
+			FID_COAP_VERSION       = 11,
+			FID_COAP_TYPE          = 12,
+			FID_COAP_TKL           = 13,
+			FID_COAP_CODE          = 14,
+			FID_COAP_MID           = 15,
+			FID_COAP_TOKEN         = 16,
+			FID_COUNT              = 17
+		};
+
+		/** Matching operators
+		 */
+		enum
+		{
+			MO_EQUAL  = 0,
+			MO_IGNORE = 1,
+			MO_MSB    = 2
+		};
+
+		/** Compression/decompression actions
+		 */
+		enum
+		{
+			CDA_NOT_SENT   = 0,
+			CDA_VALUE_SENT = 1,
+			CDA_LSB        = 2
+		};
+
+		/** Description of one field in a rule. The target of the CoAP token
+		 *  is the token bytes read as a big-endian integer
+		 */
+		struct Field_t
+		{
+			uint8_t  fid;
+			uint8_t  mo;
+			uint8_t  cda;
+			uint8_t  msb_bits;
+			uint64_t target;
+		};
+
+		/** Compression rule
+		 */
+		struct Rule_t
+		{
+			uint8_t        id;
+			uint8_t        count;
+			const Field_t *fields;
+		};
+
+		/** Rule context shared between device and server
+		 */
+		struct Context_t
+		{
+			uint8_t       count;
+			const Rule_t *rules;
+		};
+
+		/** Compress an IPv6/UDP/CoAP packet with the first matching rule
+		 *
+		 * @param &context Rules to compress with
+		 * @param *packet Pointer to the packet, starting at the IPv6 header
+		 * @param length Number of bytes in the packet
+		 * @param *output Pointer to a byte array in which to store the result.
+		 *                length + 1 bytes is always sufficient
+		 * @param size Size of output in bytes
+		 * @return Number of bytes written or OUTPUT_TOO_SMALL
+		 */
+		static int compress(const Context_t &context, const uint8_t *packet, size_t length,
+		                    uint8_t *output, size_t size);
+
+		/** Rebuild a packet produced by compress()
+		 *
+		 * @param &context Rules the packet was compressed with
+		 * @param *input Pointer to the compressed packet
+		 * @param length Number of bytes in the compressed packet
+		 * @param *packet Pointer to a byte array in which to store the packet
+		 * @param size Size of packet in bytes
+		 * @return Number of bytes written, OUTPUT_TOO_SMALL, INVALID_PACKET
+		 *         or UNKNOWN_RULE
+		 */
+		static int decompress(const Context_t &context, const uint8_t *input, size_t length,
+		                      uint8_t *packet, size_t size);
+
+
+	private:
+
+		/** Bit position and width of each field in the uncompressed headers.
+		 *  The token width of 0 means TKL bytes
+		 */
+		struct Layout_t
+		{
+			uint16_t bit;
+			uint8_t  bits;
+		};
+
+		static const Layout_t _layout[FID_COUNT];
+
+		/** Find the description of a field in a rule
+		 *
+		 * @param &rule Rule to search
+		 * @param fid Field identifier
+		 * @return Pointer to the field or NULL if the rule does not list it
+		 */
+		static const Field_t *_find_field(const Rule_t &rule, uint8_t fid);
+
+		/** Does every field described by a rule match the packet?
+		 *
+		 * @param &rule Rule to test
+		 * @param *packet Pointer to the packet
+		 * @param tkl CoAP token length of the packet
+		 * @return True if the rule can compress the packet
+		 */
+		static bool _matches(const Rule_t &rule, const uint8_t *packet, uint8_t tkl);
+
+		/** Read up to 64 bits, most significant bit first
+		 *
+		 * @param *data Pointer to the data to read from
+		 * @param bit Index of the first bit
+		 * @param bits Number of bits to read
+		 * @return Bits read
+		 */
+		static uint64_t _get_bits(const uint8_t *data, size_t bit, uint8_t bits);
+
+		/** Write up to 64 bits, most significant bit first
+		 *
+		 * @param *data Pointer to the data to write to
+		 * @param bit Index of the first bit
+		 * @param bits Number of bits to write
+		 * @param value Bits to write
+		 */
+		static void _set_bits(uint8_t *data, size_t bit, uint8_t bits, uint64_t value);
+
+		/** Fill in the IPv6 payload length, UDP length and UDP checksum
+		 *
+		 * @param *packet Pointer to the packet
+		 * @param length Number of bytes in the packet
+		 */
+		static void _compute_fields(uint8_t *packet, size_t length);
+};
@@ -0,0 +1,172 @@
+/**
+  * @file    SaraN2Schema.h
+  * @version 0.5.0
+  * @author  Adam Mitchell
+  * @brief   Compile-time schema-driven, bit-packed payload serializer. Header
+  *          only and free of Mbed dependencies, so the same schema declaration
+  *          encodes on the MCU and decodes on the server
+  */
+
+/** Define to prevent recursive inclusion
+ */
+#pragma once
+
+/** Includes
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/** A single field of a PayloadSchema. The value is transmitted as an
+ *  unsigned integer of Bits bits, where raw = round(value * Scale) - Offset,
+ *  clamped to the range of the field. For example a temperature from -40.0
+ *  to 85.0 degrees in tenths of a degree is SchemaField<11, 10, -400>
+ *
+ * @tparam Bits Width of the field in bits, between 1 and 32
+ * @tparam Scale Multiplier applied to the value before rounding
+ * @tparam Offset Subtracted from the scaled value so that it is unsigned
+ */
+template <uint8_t Bits, int32_t Scale = 1, int32_t Offset = 0>
+struct SchemaField
+{
+	static_assert(Bits >= 1 && Bits <= 32, "SchemaField width must be between 1 and 32 bits");
+	static_assert(Scale != 0, "SchemaField scale must not be zero");
+
+	static constexpr uint8_t bits   = Bits;
+	static constexpr int32_t scale  = Scale;
+	static constexpr int32_t offset = Offset;
+};
+
+/** Compile-time helpers for PayloadSchema
+ */
+namespace saran2_schema
+{
+	template <typename... Fields>
+	struct Traits;
+
+	template <>
+	struct Traits<>
+	{
+		static constexpr size_t bits = 0;
+
+		static constexpr uint32_t hash(uint32_t seed)
+		{
+			return seed;
+		}
+	};
+
+	template <typename Field, typename... Fields>
+	struct Traits<Field, Fields...>
+	{
+		static constexpr size_t bits = Field::bits + Traits<Fields...>::bits;
+
+		/** FNV-1a over each field's width, scale and offset, so that any change
+		 *  to the layout produces a different schema hash
+		 */
+		static constexpr uint32_t mix(uint32_t hash, uint32_t value, int byte)
+		{
+			return (byte == 4) ? hash : mix((hash ^ ((value >> (8 * byte)) & 0xFF)) * 16777619UL, value, byte + 1);
+		}
+
+		static constexpr uint32_t hash(uint32_t seed)
+		{
+			return Traits<Fields...>::hash(mix(mix(mix(seed, Field::bits, 0), (uint32_t)Field::scale, 0),
+			                                   (uint32_t)Field::offset, 0));
+		}
+	};
+}
+
+/** Bit-packed payload layout declared once as a list of SchemaField types,
+ *  i.e.
+ *
+ *  typedef PayloadSchema<SchemaField<11, 10, -400>,  // temperature, 0.1 C
+ *                        SchemaField<7>,             // humidity, %
+ *                        SchemaField<8, 50>> Reading; // battery, 20 mV
+ *
+ *  uint8_t payload[Reading::size]; // 4 bytes
+ *  Reading::encode(values, payload);
+ *
+ *  Fields are packed most significant bit first with no padding between
+ *  them, so the layout is independent of compiler, alignment and endianness
+ */
+template <typename... Fields>
+class PayloadSchema
+{
+
+	public:
+
+		static constexpr size_t   field_count = sizeof...(Fields);
+		static constexpr size_t   bits        = saran2_schema::Traits<Fields...>::bits;
+		static constexpr size_t   size        = (bits + 7) / 8;
+		static constexpr uint32_t hash        = saran2_schema::Traits<Fields...>::hash(2166136261UL);
+
+		/** Encode one value per field into a payload buffer. Performs no
+		 *  allocation
+		 *
+		 * @param &values Array of field values, in declaration order
+		 * @param &buffer Array of size bytes in which to store the payload
+		 */
+		template <typename T>
+		static void encode(const T (&values)[field_count], uint8_t (&buffer)[size])
+		{
+			const uint8_t widths[] = { Fields::bits... };
+			const int32_t scales[] = { Fields::scale... };
+			const int32_t offsets[] = { Fields::offset... };
+
+			memset(buffer, 0, size);
+
+			size_t bit = 0;
+
+			for(size_t i = 0; i < field_count; i++)
+			{
+				T scaled = values[i] * scales[i];
+				int64_t rounded = (int64_t)(scaled >= 0 ? scaled + (T)0.5 : scaled - (T)0.5);
+				int64_t raw = rounded - offsets[i];
+
+				int64_t max = ((int64_t)1 << widths[i]) - 1;
+				if(raw < 0)
+				{
+					raw = 0;
+				}
+				else if(raw > max)
+				{
+					raw = max;
+				}
+
+				for(int b = widths[i] - 1; b >= 0; b--, bit++)
+				{
+					if((raw >> b) & 1)
+					{
+						buffer[bit >> 3] |= 0x80 >> (bit & 7);
+					}
+				}
+			}
+		}
+
+		/** Decode a payload buffer into one value per field
+		 *
+		 * @param &buffer Array of size bytes containing the payload
+		 * @param &values Array in which to store the field values
+		 */
+		template <typename T>
+		static void decode(const uint8_t (&buffer)[size], T (&values)[field_count])
+		{
+			const uint8_t widths[] = { Fields::bits... };
+			const int32_t scales[] = { Fields::scale... };
+			const int32_t offsets[] = { Fields::offset... };
+
+			size_t bit = 0;
+
+			for(size_t i = 0; i < field_count; i++)
+			{
+				int64_t raw = 0;
+
+				for(int b = 0; b < widths[i]; b++, bit++)
+				{
+					raw = (raw << 1) | ((buffer[bit >> 3] >> (7 - (bit & 7))) & 1);
+				}
+
+				values[i] = (T)(raw + offsets[i]) / scales[i];
+			}
+		}
+};
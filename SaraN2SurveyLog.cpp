@@ -0,0 +1,177 @@
+/**
+  * @file    SaraN2SurveyLog.cpp
+  * @version 0.5.0
+  * @author  Adam Mitchell
+  * @brief   C++ file of the compact binary log of RF coverage survey samples
+  */
+
+/** Includes
+ */
+#include "SaraN2SurveyLog.h"
+
+#include <string.h>
+
+/** Range of each signed difference in a delta record
+ */
+#define DELTA_TIME_MAX     0xFFFF
+#define DELTA_POSITION_MIN -8388608
+#define DELTA_POSITION_MAX 8388607
+#define DELTA_POWER_MIN    -128
+#define DELTA_POWER_MAX    127
+
+/** Constructor for the SaraN2SurveyLog class
+ *
+ * @param keyframe_interval Maximum number of records between
+ *                          keyframes, from 1 to 255
+ */
+SaraN2SurveyLog::SaraN2SurveyLog(uint8_t keyframe_interval) :
+	_keyframe_interval((keyframe_interval != 0) ? keyframe_interval : 1), _since_keyframe(0),
+	_started(false)
+{
+	memset(&_last, 0, sizeof(_last));
+}
+
+/** Write the log header, once at the start of a log
+ *
+ * @param *buffer Pointer to at least SARAN2_SURVEY_HEADER_SIZE bytes
+ * @return Number of bytes written
+ */
+size_t SaraN2SurveyLog::header(uint8_t *buffer)
+{
+	uint8_t *p = _put(buffer, SARAN2_SURVEY_MAGIC, 4);
+	p = _put(p, SARAN2_SURVEY_VERSION, 1);
+	p = _put(p, _keyframe_interval, 1);
+	_put(p, 0, 2);
+
+	return SARAN2_SURVEY_HEADER_SIZE;
+}
+
+/** Encode a sample as the next record of the log
+ *
+ * @param &sample Sample to encode
+ * @param *buffer Pointer to at least SARAN2_SURVEY_KEYFRAME_SIZE
+ *                bytes in which to store the record
+ * @return Number of bytes written, SARAN2_SURVEY_KEYFRAME_SIZE or
+ *         SARAN2_SURVEY_DELTA_SIZE
+ */
+size_t SaraN2SurveyLog::append(const Sample_t &sample, uint8_t *buffer)
+{
+	uint8_t *p = buffer;
+	size_t length;
+
+	if(_started && _since_keyframe < _keyframe_interval && _fits_delta(sample))
+	{
+		/* Unsigned subtraction wraps to the two's complement difference,
+		 * and _put() keeps only the low bytes
+		 */
+		p = _put(p, SaraN2SurveyLog::RECORD_DELTA, 1);
+		p = _put(p, sample.time_ms - _last.time_ms, 2);
+		p = _put(p, (uint32_t)sample.latitude_e7 - (uint32_t)_last.latitude_e7, 3);
+		p = _put(p, (uint32_t)sample.longitude_e7 - (uint32_t)_last.longitude_e7, 3);
+		p = _put(p, sample.signal_power - _last.signal_power, 1);
+		p = _put(p, sample.total_power - _last.total_power, 1);
+		p = _put(p, sample.tx_power - _last.tx_power, 1);
+		p = _put(p, sample.snr - _last.snr, 1);
+		_put(p, sample.rsrq - _last.rsrq, 1);
+
+		_since_keyframe++;
+		length = SARAN2_SURVEY_DELTA_SIZE;
+	}
+	else
+	{
+		p = _put(p, SaraN2SurveyLog::RECORD_KEYFRAME, 1);
+		p = _put(p, sample.ecl, 1);
+		p = _put(p, sample.pci, 2);
+		p = _put(p, sample.time_ms, 4);
+		p = _put(p, sample.latitude_e7, 4);
+		p = _put(p, sample.longitude_e7, 4);
+		p = _put(p, sample.cell_id, 4);
+		p = _put(p, sample.earfcn, 4);
+		p = _put(p, sample.signal_power, 2);
+		p = _put(p, sample.total_power, 2);
+		p = _put(p, sample.tx_power, 2);
+		p = _put(p, sample.snr, 2);
+		_put(p, sample.rsrq, 2);
+
+		_since_keyframe = 0;
+		_started = true;
+		length = SARAN2_SURVEY_KEYFRAME_SIZE;
+	}
+
+	_last = sample;
+
+	return length;
+}
+
+/** Force the next record to be a keyframe
+ */
+void SaraN2SurveyLog::restart()
+{
+	_started = false;
+}
+
+/** Do all differences from the previous sample fit a delta record?
+ *
+ * @param &sample Sample to encode
+ * @return True if a delta record can be written
+ */
+bool SaraN2SurveyLog::_fits_delta(const Sample_t &sample)
+{
+	if(sample.cell_id != _last.cell_id || sample.earfcn != _last.earfcn ||
+	   sample.pci != _last.pci || sample.ecl != _last.ecl)
+	{
+		return false;
+	}
+
+	if(sample.time_ms - _last.time_ms > DELTA_TIME_MAX)
+	{
+		return false;
+	}
+
+	int64_t latitude = (int64_t)sample.latitude_e7 - _last.latitude_e7;
+	int64_t longitude = (int64_t)sample.longitude_e7 - _last.longitude_e7;
+
+	if(latitude < DELTA_POSITION_MIN || latitude > DELTA_POSITION_MAX ||
+	   longitude < DELTA_POSITION_MIN || longitude > DELTA_POSITION_MAX)
+	{
+		return false;
+	}
+
+	const int powers[][2] =
+	{
+		{ sample.signal_power, _last.signal_power },
+		{ sample.total_power,  _last.total_power  },
+		{ sample.tx_power,     _last.tx_power     },
+		{ sample.snr,          _last.snr          },
+		{ sample.rsrq,         _last.rsrq         }
+	};
+
+	for(size_t i = 0; i < sizeof(powers) / sizeof(powers[0]); i++)
+	{
+		int delta = powers[i][0] - powers[i][1];
+
+		if(delta < DELTA_POWER_MIN || delta > DELTA_POWER_MAX)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Write the low bytes of a value, least significant first
+ *
+ * @param *buffer Pointer to the bytes to write
+ * @param value Value to write
+ * @param bytes Number of bytes to write
+ * @return Pointer to the byte after those written
+ */
+uint8_t *SaraN2SurveyLog::_put(uint8_t *buffer, uint32_t value, uint8_t bytes)
+{
+	for(uint8_t i = 0; i < bytes; i++)
+	{
+		*buffer++ = value >> (8 * i);
+	}
+
+	return buffer;
+}
@@ -0,0 +1,130 @@
+/**
+  * @file    SaraN2SurveyLog.h
+  * @version 0.5.0
+  * @author  Adam Mitchell
+  * @brief   Header file of the compact binary log of RF coverage survey
+  *          samples. Has no Mbed dependencies, and tools/survey_convert.py
+  *          reads the same format on the host
+  */
+
+/** Define to prevent recursive inclusion
+ */
+#pragma once
+
+/** Includes
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+/** Log-specific #defines
+ */
+#define SARAN2_SURVEY_MAGIC         0x53324E53UL /* "SN2S" when written little-endian */
+#define SARAN2_SURVEY_VERSION       1
+#define SARAN2_SURVEY_HEADER_SIZE   8
+#define SARAN2_SURVEY_KEYFRAME_SIZE 34
+#define SARAN2_SURVEY_DELTA_SIZE    14
+
+#ifndef SARAN2_SURVEY_KEYFRAME_INTERVAL
+#define SARAN2_SURVEY_KEYFRAME_INTERVAL 64
+#endif
+
+/** Appends survey samples to a log as fixed-size little-endian records:
+ *
+ *  header   [magic:4] [version:1] [keyframe interval:1] [reserved:2]
+ *  keyframe [0x01] [ecl:1] [pci:2] [time:4] [lat:4] [lon:4] [cell:4]
+ *           [earfcn:4] [signal:2] [total:2] [tx:2] [snr:2] [rsrq:2]
+ *  delta    [0x02] [time:2] [lat:3] [lon:3] [signal:1] [total:1] [tx:1]
+ *           [snr:1] [rsrq:1]
+ *
+ *  A delta record holds signed differences from the previous record. A
+ *  keyframe is written for the first sample, every keyframe interval, on a
+ *  change of cell, EARFCN, PCI or ECL, and whenever a difference does not
+ *  fit. A 1 Hz survey in one cell costs 14 bytes per sample rather than 34.
+ *  Calling restart() at the start of each flash page or file makes it
+ *  decodable on its own, so a log survives a lost page
+ */
+class SaraN2SurveyLog
+{
+
+	public:
+
+		/** Record types
+		 */
+		enum
+		{
+			RECORD_KEYFRAME = 0x01,
+			RECORD_DELTA    = 0x02
+		};
+
+		/** One survey sample. Powers and ratios are in tenths of a dBm or
+		 *  dB, as reported by AT+NUESTATS="RADIO". The position is filled
+		 *  in by the application, in units of 1e-7 degrees
+		 */
+		struct Sample_t
+		{
+			uint32_t time_ms;
+			int32_t  latitude_e7;
+			int32_t  longitude_e7;
+			uint32_t cell_id;
+			uint32_t earfcn;
+			uint16_t pci;
+			uint8_t  ecl;
+			int16_t  signal_power;
+			int16_t  total_power;
+			int16_t  tx_power;
+			int16_t  snr;
+			int16_t  rsrq;
+		};
+
+		/** Constructor for the SaraN2SurveyLog class
+		 *
+		 * @param keyframe_interval Maximum number of records between
+		 *                          keyframes, from 1 to 255
+		 */
+		SaraN2SurveyLog(uint8_t keyframe_interval = SARAN2_SURVEY_KEYFRAME_INTERVAL);
+
+		/** Write the log header, once at the start of a log
+		 *
+		 * @param *buffer Pointer to at least SARAN2_SURVEY_HEADER_SIZE bytes
+		 * @return Number of bytes written
+		 */
+		size_t header(uint8_t *buffer);
+
+		/** Encode a sample as the next record of the log
+		 *
+		 * @param &sample Sample to encode
+		 * @param *buffer Pointer to at least SARAN2_SURVEY_KEYFRAME_SIZE
+		 *                bytes in which to store the record
+		 * @return Number of bytes written, SARAN2_SURVEY_KEYFRAME_SIZE or
+		 *         SARAN2_SURVEY_DELTA_SIZE
+		 */
+		size_t append(const Sample_t &sample, uint8_t *buffer);
+
+		/** Force the next record to be a keyframe
+		 */
+		void restart();
+
+
+	private:
+
+		/** Do all differences from the previous sample fit a delta record?
+		 *
+		 * @param &sample Sample to encode
+		 * @return True if a delta record can be written
+		 */
+		bool _fits_delta(const Sample_t &sample);
+
+		/** Write the low bytes of a value, least significant first
+		 *
+		 * @param *buffer Pointer to the bytes to write
+		 * @param value Value to write
+		 * @param bytes Number of bytes to write
+		 * @return Pointer to the byte after those written
+		 */
+		static uint8_t *_put(uint8_t *buffer, uint32_t value, uint8_t bytes);
+
+		Sample_t _last;
+		uint8_t  _keyframe_interval;
+		uint8_t  _since_keyframe;
+		bool     _started;
+};
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""
+Build a SaraN2Compression static dictionary from sample payloads, i.e.
+
+    python3 tools/build_dictionary.py --id 1 samples/*.json > dictionary_v1.h
+
+Each sample file holds one message. Substrings that recur across messages
+are scored by the bytes they would save, (length - 1) * occurrences, and
+the best non-overlapping candidates are emitted as a C++ table that can be
+compiled into both the device firmware and the server decoder
+"""
+
+import argparse
+import sys
+from collections import Counter
+
+MAX_ENTRIES = 127
+MIN_LENGTH = 3
+MAX_LENGTH = 32
+
+
+def candidates(samples):
+    """ Count every substring between MIN_LENGTH and MAX_LENGTH bytes long
+    """
+    counts = Counter()
+
+    for sample in samples:
+        for start in range(len(sample)):
+            for length in range(MIN_LENGTH, min(MAX_LENGTH, len(sample) - start) + 1):
+                counts[sample[start:start + length]] += 1
+
+    return counts
+
+
+def select(samples, counts, max_entries):
+    """ Greedily pick the candidate saving the most bytes, then remove its
+        occurrences from the samples so overlapping candidates are rescored
+    """
+    entries = []
+    remaining = list(samples)
+
+    while len(entries) < max_entries and counts:
+        best, score = None, 0
+        for candidate, count in counts.items():
+            saving = (len(candidate) - 1) * count
+            if count > 1 and saving > score:
+                best, score = candidate, saving
+
+        if best is None:
+            break
+
+        entries.append(best)
+        remaining = [part for sample in remaining for part in sample.split(best) if part]
+        counts = candidates(remaining)
+
+    return entries
+
+
+def emit(dictionary_id, entries, out):
+    """ Write the dictionary as a SaraN2Compression::Dictionary_t definition
+    """
+    out.write("/** Generated by tools/build_dictionary.py, do not edit\n */\n")
+    out.write("#pragma once\n\n#include \"SaraN2Compression.h\"\n\n")
+
+    for index, entry in enumerate(entries):
+        data = ", ".join("0x%02X" % byte for byte in entry)
+        out.write("static const uint8_t dictionary_v%d_%d[] = { %s };\n" % (dictionary_id, index, data))
+
+    out.write("\nstatic const SaraN2Compression::Entry_t dictionary_v%d_entries[] =\n{\n" % dictionary_id)
+    for index, entry in enumerate(entries):
+        out.write("\t{ dictionary_v%d_%d, %d }, /* %r */\n" % (dictionary_id, index, len(entry),
+                                                         entry.decode("ascii", "replace")))
+    out.write("};\n\n")
+
+    out.write("static const SaraN2Compression::Dictionary_t dictionary_v%d =\n" % dictionary_id)
+    out.write("{\n\t%d, %d, dictionary_v%d_entries\n};\n" % (dictionary_id, len(entries), dictionary_id))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a SaraN2Compression dictionary")
+    parser.add_argument("--id", type=int, required=True, help="dictionary id, 0-255")
+    parser.add_argument("--entries", type=int, default=MAX_ENTRIES, help="maximum number of entries")
+    parser.add_argument("samples", nargs="+", help="files containing one sample payload each")
+    args = parser.parse_args()
+
+    samples = []
+    for path in args.samples:
+        with open(path, "rb") as sample:
+            samples.append(sample.read())
+
+    entries = select(samples, candidates(samples), min(args.entries, MAX_ENTRIES))
+    emit(args.id, entries, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""
+Report the flash cost of each SaraN2 driver feature from the GNU ld map file
+of an Mbed GCC_ARM build, i.e.
+
+    mbed compile -t GCC_ARM -m <TARGET>
+    python3 tools/footprint.py BUILD/<TARGET>/GCC_ARM/<app>.map
+
+Mbed builds with -ffunction-sections and -fdata-sections, so every driver
+method has its own input section in the map and can be attributed to the
+SARAN2_FEATURE_x flag that compiles it.
+
+RAM is not reported: the state of each feature lives in SaraN2 members, so
+it is part of sizeof(SaraN2) wherever the application places the object and
+never appears as a driver .data or .bss section. Compare sizeof(SaraN2)
+between builds with different flags to measure it
+"""
+
+import re
+import sys
+from collections import OrderedDict
+
+# Method name -> feature flag. Anything not listed is always compiled in
+FEATURES = OrderedDict([
+    ("SARAN2_FEATURE_ASYNC_BOOT", ["begin", "wait_ready", "is_ready", "_boot_task"]),
+    ("SARAN2_FEATURE_COAP_PROFILES", ["select_profile", "load_profile", "save_profile",
+                                      "set_profile_validity", "set_coap_ip_port", "set_coap_uri",
+                                      "pdu_header_add_uri_host", "pdu_header_add_uri_port",
+                                      "pdu_header_add_uri_path", "pdu_header_add_uri_query",
+                                      "pdu_header_remove_uri_host", "pdu_header_remove_uri_port",
+                                      "pdu_header_remove_uri_path", "pdu_header_remove_uri_query",
+                                      "select_coap_at_interface"]),
+    ("SARAN2_FEATURE_COAP", ["parse_coap_response", "coap_get", "coap_delete", "coap_put",
+                             "coap_post", "_read_coap_response"]),
+    ("SARAN2_FEATURE_PSM", ["npsmr", "enable_power_save_mode", "disable_power_save_mode",
+                            "query_power_save_mode", "set_t3412_timer", "get_t3412_timer",
+                            "set_t3324_timer", "get_t3324_timer", "_read_psm_settings",
+                            "get_granted_psm_timers", "get_requested_psm_timers", "set_psm_fallback",
+                            "begin_uplink_burst", "end_uplink_burst", "_read_cereg_report",
+                            "_psm_fallback_active"]),
+    ("SARAN2_FEATURE_NCONFIG", ["configure_ue"]),
+    ("SARAN2_FEATURE_RADIO", ["cereg", "cscon", "get_radio_status", "deactivate_radio",
+                              "activate_radio", "gprs_attach", "gprs_detach",
+                              "auto_register_to_network", "deregister_from_network"]),
+    ("SARAN2_FEATURE_STATS", ["nuestats"]),
+    ("SARAN2_FEATURE_TIME", ["sync_network_time", "set_time_zone_reporting", "get_timestamp",
+                             "get_time_zone", "set_clock_drift_ppm", "_update_network_time",
+                             "_nitz_urc"]),
+    ("SARAN2_FEATURE_FOTA", ["download_firmware_package", "apply_firmware_package",
+                             "_send_firmware_segment"]),
+    ("SARAN2_FEATURE_HEALTH", ["get_health", "reset_health", "encode_health_record",
+                               "set_health_piggyback", "_put_varint"]),
+    ("SARAN2_FEATURE_TIMELINE", ["enable_coap_timeline", "disable_coap_timeline",
+                                 "get_coap_phase_percentile", "_timeline_complete", "_cscon_urc"]),
+    ("SARAN2_FEATURE_OPERATOR_PROFILES", ["set_operator_profile", "clear_operator_profiles",
+                                          "get_serving_plmn", "apply_operator_profile",
+                                          "set_operator_profile_auto", "get_operator_profile",
+                                          "_read_serving_plmn", "_read_operator"]),
+    ("SARAN2_FEATURE_ADAPTIVE_TIMEOUT", ["get_command_timeout", "reset_command_timeouts"]),
+    ("SARAN2_FEATURE_WARM_STATE", ["get_imei", "save_warm_state", "restore_warm_state", "_read_imei",
+                                   "_crc32"]),
+    ("SARAN2_FEATURE_WAKE", ["set_wake_idle_time", "get_wake_stats"]),
+    ("SARAN2_FEATURE_RATE_CONTROL", ["read_apn_rate_control", "get_uplink_allowance", "set_uplink_pacing",
+                                     "_read_apn_rate_control", "_refill_uplink_tokens"]),
+    ("SARAN2_FEATURE_BACKOFF", ["get_backoff", "clear_backoff", "_update_backoff", "_backoff_random"]),
+    ("SARAN2_FEATURE_SURVEY", ["survey_sample"]),
+    ("SARAN2_FEATURE_COAP_METHODS", ["set_coap_socket_target", "coap_fetch", "coap_patch", "coap_ipatch",
+                                     "_coap_socket_request", "_open_coap_socket", "_coap_header",
+                                     "_send_coap_datagram", "_read_coap_datagram",
+                                     "_read_socket_reply"]),
+])
+
+SECTION = re.compile(r"^ (\.(?:text|rodata)\S*)\s*(?:\n\s+)?(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S+)",
+                     re.MULTILINE)
+METHOD = re.compile(r"_ZN\d*6SaraN2(\d+)")
+
+
+def method_name(section):
+    """ Return the unmangled SaraN2 method name of an input section, if any
+    """
+    match = METHOD.search(section)
+    if match is None:
+        return None
+
+    length = int(match.group(1))
+    start = match.end()
+
+    return section[start:start + length]
+
+
+def main(map_path):
+    with open(map_path) as map_file:
+        text = map_file.read()
+
+    owner = {}
+    for feature, methods in FEATURES.items():
+        for method in methods:
+            owner[method] = feature
+
+    totals = OrderedDict((feature, 0) for feature in list(FEATURES) + ["core"])
+
+    for section, _, size, obj in SECTION.findall(text):
+        if "SaraN2Driver" not in obj:
+            continue
+
+        feature = owner.get(method_name(section), "core")
+        totals[feature] += int(size, 16)
+
+    print("%-32s %10s" % ("Feature", "Flash (B)"))
+    for feature, flash in totals.items():
+        print("%-32s %10d" % (feature, flash))
+    print("%-32s %10d" % ("Total", sum(totals.values())))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("Usage: %s <map file>" % sys.argv[0])
+        sys.exit(1)
+
+    main(sys.argv[1])
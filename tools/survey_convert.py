@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""
+Convert a SaraN2SurveyLog binary coverage survey log to CSV, i.e.
+
+    python3 tools/survey_convert.py survey.bin > survey.csv
+
+Records are decoded exactly as SaraN2SurveyLog.h lays them out: keyframes
+carry absolute values and delta records signed differences from the record
+before. Powers and ratios are converted from tenths to dBm/dB and positions
+to degrees. A log may be the concatenation of several logs, i.e. flash
+pages, each starting with its own header
+"""
+
+import argparse
+import csv
+import struct
+import sys
+
+MAGIC = 0x53324E53
+VERSION = 1
+HEADER = struct.Struct("<IBBH")
+KEYFRAME = struct.Struct("<BBHIiiIIhhhhh")
+RECORD_KEYFRAME = 0x01
+RECORD_DELTA = 0x02
+DELTA_SIZE = 14
+
+COLUMNS = ["time_ms", "latitude", "longitude", "cell_id", "earfcn", "pci", "ecl",
+           "signal_power_dbm", "total_power_dbm", "tx_power_dbm", "snr_db", "rsrq_db"]
+
+
+def signed(data, bytes_):
+    """ Read a little-endian two's complement integer of any width
+    """
+    return int.from_bytes(data[:bytes_], "little", signed=True)
+
+
+def decode(data):
+    """ Yield one dict per record, with the raw integer values of the log
+    """
+    position = 0
+    last = None
+
+    while position < len(data):
+        if position + HEADER.size <= len(data):
+            magic, version, _, _ = HEADER.unpack_from(data, position)
+            if magic == MAGIC:
+                if version != VERSION:
+                    raise ValueError("unsupported log version %d at offset %d" % (version, position))
+                position += HEADER.size
+                continue
+
+        kind = data[position]
+
+        if kind == RECORD_KEYFRAME and position + KEYFRAME.size <= len(data):
+            (_, ecl, pci, time_ms, latitude, longitude, cell_id, earfcn,
+             signal, total, tx, snr, rsrq) = KEYFRAME.unpack_from(data, position)
+            last = dict(time_ms=time_ms, latitude=latitude, longitude=longitude, cell_id=cell_id,
+                        earfcn=earfcn, pci=pci, ecl=ecl, signal=signal, total=total, tx=tx,
+                        snr=snr, rsrq=rsrq)
+            position += KEYFRAME.size
+
+        elif kind == RECORD_DELTA and position + DELTA_SIZE <= len(data):
+            record = data[position + 1:position + DELTA_SIZE]
+            position += DELTA_SIZE
+
+            if last is None:
+                # A delta without a preceding keyframe, i.e. the start of a
+                # page was lost. Skip until the next keyframe
+                continue
+
+            last = dict(last)
+            last["time_ms"] = (last["time_ms"] + int.from_bytes(record[0:2], "little")) & 0xFFFFFFFF
+            last["latitude"] += signed(record[2:5], 3)
+            last["longitude"] += signed(record[5:8], 3)
+            for i, key in enumerate(("signal", "total", "tx", "snr", "rsrq")):
+                last[key] += signed(record[8 + i:9 + i], 1)
+
+        else:
+            raise ValueError("invalid record type 0x%02X at offset %d" % (kind, position))
+
+        yield last
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("log", help="binary survey log")
+    args = parser.parse_args()
+
+    with open(args.log, "rb") as f:
+        data = f.read()
+
+    writer = csv.writer(sys.stdout)
+    writer.writerow(COLUMNS)
+
+    for r in decode(data):
+        writer.writerow([r["time_ms"], "%.7f" % (r["latitude"] / 1e7), "%.7f" % (r["longitude"] / 1e7),
+                         r["cell_id"], r["earfcn"], r["pci"], r["ecl"],
+                         r["signal"] / 10, r["total"] / 10, r["tx"] / 10, r["snr"] / 10, r["rsrq"] / 10])
+
+
+if __name__ == "__main__":
+    main()